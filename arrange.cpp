@@ -28,8 +28,13 @@
 #include <cassert>
 #include "arrange.h"
 #include "lagrange.h"
+#include "threads.h"
+#include "propolis.h"
 using namespace std;
 
+#define GLYPHGRAIN 4096
+// Fewest letters worth reading in another thread
+
 /* Change in code (April 2017):
  * After over four years of wondering how this layer of Reed-Solomon and
  * letter code can be decoded, taking advantage of the one-bit error letter
@@ -549,7 +554,7 @@ void CodeMatrix::dump()
 void CodeMatrix::arrange(harray<char> &hletters)
 {
   int i;
-  hvec k;
+  hcursor<char> k(hletters,size);
   assert(metadata.size()>=6);
   hletters[hvec(-size,0)]=metadata[0];
   if (metadata.size()==7)
@@ -569,34 +574,94 @@ void CodeMatrix::arrange(harray<char> &hletters)
     hletters[hvec(0,-size)]    =metadata[4];
     hletters[hvec(-size,-size)]=metadata[5];
   }
-  for (i=0,k=start(size);i<data.size();i++,k.inc(size))
+  for (i=0;i<data.size();i++,k.inc())
   {
-    if (k.norm()==sqr(size) || (metadata.size()==7 && k==0))
-      k.inc(size); // skip the 6 or 7 metadata letters
-    hletters[k]=data[i];
+    if (k.where().norm()==sqr(size) || (metadata.size()==7 && k.where()==0))
+      k.inc(); // skip the 6 or 7 metadata letters
+    *k=data[i];
   }
 }
 
+vector<hvec> metaplaces(int size)
+// Places of the metadata letters, in the order of metadata.
+{
+  vector<hvec> ret;
+  ret.push_back(hvec(-size,0));
+  if (size>30)
+    ret.push_back(hvec(0,0));
+  ret.push_back(hvec(0,size));
+  ret.push_back(hvec(size,size));
+  ret.push_back(hvec(size,0));
+  ret.push_back(hvec(0,-size));
+  ret.push_back(hvec(-size,-size));
+  return ret;
+}
+
 void CodeMatrix::unarrange(harray<uint16_t> &hglyphs)
 {
   int i;
-  hvec k;
+  hcursor<uint16_t> k(hglyphs,size);
+  vector<hvec> meta=metaplaces(size);
   metaglyphs.clear();
-  metaglyphs.push_back(hglyphs[hvec(-size,0)]);
-  if (size>30)
-    metaglyphs.push_back(hglyphs[hvec(0,0)]);
-  metaglyphs.push_back(hglyphs[hvec(0,size)]);
-  metaglyphs.push_back(hglyphs[hvec(size,size)]);
-  metaglyphs.push_back(hglyphs[hvec(size,0)]);
-  metaglyphs.push_back(hglyphs[hvec(0,-size)]);
-  metaglyphs.push_back(hglyphs[hvec(-size,-size)]);
+  for (i=0;i<meta.size();i++)
+    metaglyphs.push_back(hglyphs.get(meta[i]));
   glyphs.clear();
-  for (i=0,k=start(size);k.cont(size);i++,k.inc(size))
+  for (;k.cont();k.inc())
+    if (k.where().norm()!=sqr(size) && (metaglyphs.size()<7 || k.where()!=0))
+      glyphs.push_back(k.get());
+}
+
+void CodeMatrix::readAllGlyphs(int sz,harray<bool> &canvas)
+/* Reads all the letters of a symbol of size sz from the canvas into
+ * metaglyphs and glyphs, in the same order as arrange and unarrange.
+ * The rows of the hexagon are read in parallel, if there are enough letters
+ * to be worth handing to other threads. Each row knows where its first
+ * glyph goes, by counting the places in the rows below it, less the
+ * metadata places among them.
+ */
+{
+  vector<hvec> meta;
+  vector<int> rowstart;
+  int i,y,n;
+  size=sz;
+  nLetters=ndataletters(size);
+  meta=metaplaces(size);
+  metaglyphs.resize(meta.size());
+  for (i=0;i<meta.size();i++)
+    metaglyphs[i]=canvas.letterBits(meta[i]);
+  rowstart.resize(2*size+2);
+  for (y=-size,n=0;y<=size;y++)
   {
-    if (k.norm()==sqr(size) || (metaglyphs.size()==7 && k==0))
-      k.inc(size); // skip the 6 or 7 metadata letters
-    glyphs[i]=hglyphs[k];
+    rowstart[y+size]=n;
+    n+=2*size+1-abs(y);
+    for (i=0;i<meta.size();i++)
+      if (meta[i].gety()==y)
+	n--;
   }
+  rowstart[2*size+1]=n;
+  assert(n==nLetters);
+  glyphs.resize(nLetters);
+  parallelFor(2*size+1,[&](int row)
+  {
+    int x,i=rowstart[row],y=row-size;
+    hvec k;
+    for (x=max(-size,y-size);x<=min(size,y+size);x++)
+    {
+      k=hvec(x,y);
+      if (k.norm()!=sqr(size) && (meta.size()<7 || k!=0))
+	glyphs[i++]=canvas.letterBits(k);
+    }
+  },GLYPHGRAIN/(2*size+1)+1);
+}
+
+vector<uint16_t> CodeMatrix::getMetaglyphs()
+{
+  return metaglyphs;
+}
+
+vector<uint16_t> CodeMatrix::getGlyphs()
+{
+  return glyphs;
 }
 
 int decinc(int i)
@@ -672,3 +737,49 @@ void testCheckLetters()
     cout<<'\n';
   }
 }
+
+void testReadAllGlyphs()
+/* Arranges random letters in a small and a large symbol, then checks that
+ * readAllGlyphs gives the same glyphs as reading them one at a time and
+ * unarranging, and that they are the letters that were arranged.
+ */
+{
+  CodeMatrix cm;
+  harray<char> hl;
+  harray<bool> canvas;
+  harray<uint16_t> hg;
+  vector<uint16_t> meta1,glyphs1;
+  string str;
+  hvec k;
+  int i,n,size,errors=0;
+  for (n=100;n<5000;n*=30)
+  {
+    str.clear();
+    for (i=0;i<n;i++)
+      str+=(char)('@'+rand()%32);
+    cm.findSize(n,0.2);
+    cm.setData(str,5);
+    size=cm.getSize();
+    hl.clear();
+    canvas.clear();
+    hg.clear();
+    cm.arrange(hl);
+    for (k=start(size);k.cont(size);k.inc(size))
+    {
+      drawletter(hl.get(k)&31,k,canvas);
+      hg[k]=readglyph(k,canvas);
+    }
+    cm.unarrange(hg);
+    meta1=cm.getMetaglyphs();
+    glyphs1=cm.getGlyphs();
+    cm.readAllGlyphs(size,canvas);
+    if (meta1!=cm.getMetaglyphs() || glyphs1!=cm.getGlyphs() || glyphs1.size()!=cm.getNLetters())
+      errors++;
+    for (k=start(size),i=0;k.cont(size);k.inc(size))
+      if (k.norm()!=sqr(size) && (size<=30 || k!=0))
+	if (i>=glyphs1.size() || glyphs1[i++]!=letters[hl.get(k)&31])
+	  errors++;
+    cout<<"readAllGlyphs size "<<size<<": "<<errors<<" errors"<<endl;
+  }
+  tassert(errors==0);
+}
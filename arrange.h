@@ -37,7 +37,7 @@ private:
   std::vector<int> hammingSizes;
   std::vector<char> metadata; // 6 or 7 letters, depending on size
   std::vector<char> data; // rearranged by criss-crossing
-  std::vector<litteron> litterons;
+  LitteronBank litterons;
   std::vector<uint16_t> metaglyphs;
   std::vector<uint16_t> glyphs;
   int size,nLetters,nData,nDataCheck;
@@ -62,9 +62,13 @@ public:
   void dump();
   void arrange(harray<char> &hletters);
   void unarrange(harray<uint16_t> &hglyphs);
+  void readAllGlyphs(int sz,harray<bool> &canvas=hbits);
+  std::vector<uint16_t> getMetaglyphs();
+  std::vector<uint16_t> getGlyphs();
 };
 
 extern CodeMatrix theMatrix;
 void testbitctrot();
 void testshuffle();
 void testCheckLetters();
+void testReadAllGlyphs();
@@ -0,0 +1,29 @@
+# Converts the inverse letter table, 4096 16-bit words in the byte order
+# given by BIGENDIAN, to a C++ header defining builtinInvletters.
+# Run as: cmake -DINPUT=... -DOUTPUT=... -DBIGENDIAN=0|1 -P EmbedInvletters.cmake
+
+file(READ ${INPUT} hex HEX)
+string(LENGTH "${hex}" len)
+if (NOT len EQUAL 16384)
+  message(FATAL_ERROR "${INPUT} should be 8192 bytes long")
+endif ()
+set(body "")
+foreach (i RANGE 0 4095)
+  math(EXPR pos "${i}*4")
+  string(SUBSTRING "${hex}" ${pos} 2 byte0)
+  math(EXPR pos "${pos}+2")
+  string(SUBSTRING "${hex}" ${pos} 2 byte1)
+  if (BIGENDIAN)
+    string(APPEND body "0x${byte0}${byte1},")
+  else ()
+    string(APPEND body "0x${byte1}${byte0},")
+  endif ()
+  math(EXPR col "${i}%8")
+  if (col EQUAL 7)
+    string(APPEND body "\n")
+  endif ()
+endforeach ()
+file(WRITE ${OUTPUT}
+"// Generated from ${INPUT} by EmbedInvletters.cmake. Do not edit.\n"
+"#include <cstdint>\n"
+"constexpr uint16_t builtinInvletters[4096]=\n{\n${body}};\n")
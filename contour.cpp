@@ -26,34 +26,32 @@
 #include "contour.h"
 
 using namespace std;
+hgrid<char> tracegrid; // copy of hbits, which also holds the marks
 
 bool isedge(hvec z)
 {hvec q,r;
- q=z/2;
- r=z%2;
- return (hbits[q]^hbits[q+r])&1;
+ hdivmod<TwoMod>(z,q,r);
+ return (tracegrid[q]^tracegrid[q+r])&1;
  }
 
 bool ismarked(hvec z)
 {hvec q,r;
  int bit=1;
- q=z/2;
- r=z%2;
+ hdivmod<TwoMod>(z,q,r);
  if (r==hvec(1,1)) bit=2;
  if (r==hvec(1,0)) bit=3;
  if (r==hvec(0,-1)) bit=4;
- return (hbits[q]>>bit)&1;
+ return (tracegrid[q]>>bit)&1;
  }
 
 void mark(hvec z)
 {hvec q,r;
  int bit=1;
- q=z/2;
- r=z%2;
+ hdivmod<TwoMod>(z,q,r);
  if (r==hvec(1,1)) bit=2;
  if (r==hvec(1,0)) bit=3;
  if (r==hvec(0,-1)) bit=4;
- hbits[q]|=1<<bit;
+ tracegrid[q]|=1<<bit;
  }
 
 vector<hvec> trace(hvec stpoint)
@@ -77,9 +75,14 @@ vector<hvec> trace(hvec stpoint)
  }
 
 vector<vector<hvec> > traceall(int size)
+/* Traces all contours of hbits. The edges are at odd points of the doubled
+ * grid, out to size*8+9; the bits, including the border, are within 4*size+6.
+ */
 {vector<hvec> contour;
  vector<vector<hvec> > contours;
  hvec i;
+ tracegrid.resize(4*size+8);
+ tracegrid.copyFrom(hbits);
  for (i=start(size*8+9);i.cont(size*8+9);i.inc(size*8+9))
      {contour=trace(i);
       if (contour.size())
@@ -75,7 +75,7 @@ hvec readHvec(istream &file)
   return hvec(x,y);
 }
 
-void writeHexArray(string fileName,harray<char> &hexArray,int bits,int size)
+template <typename A> void writeHexArray1(string fileName,A &hexArray,int bits,int size)
 {
   ofstream file(fileName,ios::binary);
   vector<hvec> pages;
@@ -127,7 +127,7 @@ Header readHeader(istream &file)
   return ret;
 }
 
-Header readHexArray(string fileName,harray<char> &hexArray)
+template <typename A> Header readHexArray1(string fileName,A &hexArray)
 {
   Header ret;
   ifstream file(fileName,ios::binary);
@@ -167,3 +167,24 @@ Header readHexArray(string fileName,harray<char> &hexArray)
     ret.bits=-5;
   return ret;
 }
+
+void writeHexArray(string fileName,harray<char> &hexArray,int bits,int size)
+{
+  writeHexArray1(fileName,hexArray,bits,size);
+}
+
+void writeHexArray(string fileName,harray<bool> &hexArray,int bits,int size)
+{
+  writeHexArray1(fileName,hexArray,bits,size);
+}
+
+Header readHexArray(string fileName,harray<char> &hexArray)
+{
+  return readHexArray1(fileName,hexArray);
+}
+
+Header readHexArray(string fileName,harray<bool> &hexArray)
+// Only the low bit of each element is kept.
+{
+  return readHexArray1(fileName,hexArray);
+}
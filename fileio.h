@@ -33,5 +33,7 @@ struct Header
 };
 
 void writeHexArray(std::string fileName,harray<char> &hexArray,int bits,int size);
+void writeHexArray(std::string fileName,harray<bool> &hexArray,int bits,int size);
 Header readHexArray(std::string fileName,harray<char> &hexArray);
+Header readHexArray(std::string fileName,harray<bool> &hexArray);
 #endif
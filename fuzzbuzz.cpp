@@ -30,11 +30,13 @@
 #include "fileio.h"
 #include "letters.h"
 #include "propolis.h"
+#include "threads.h"
 
 using namespace std;
 namespace po=boost::program_options;
 
 hvec a,b,q,r;
+bool testfail=false;
 
 void initialize()
 {
@@ -110,8 +112,12 @@ int main(int argc,char **argv)
       quality=10;
     if (makedata)
     {
+      startThreads(getWorkers()-1);
+      waitForThreads(TH_RUN);
       fillinvletters();
       writeinvletters();
+      waitForThreads(TH_STOP);
+      joinThreads();
     }
     if (infilename.size())
     {
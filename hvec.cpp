@@ -25,8 +25,14 @@
 
 #include <cstdio>
 #include <iostream>
+#include <algorithm>
 #include <cstring>
 #include <stdexcept>
+#include <chrono>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "propolis.h"
 #include "hvec.h"
 #include "ps.h"
 
@@ -101,6 +107,79 @@ hvec::hvec(complex<double> z)
     norm0=norm1;*/
 }
 
+/* Batch rounding to the lattice. Each step is the same IEEE operation, in
+ * the same order, as in hvec(complex<double>), so the vector code gives
+ * bit-identical results, as long as the compiler doesn't fuse the
+ * multiplications and additions in the scalar code. The vector code keeps
+ * x and y as doubles, which hold small integers exactly. lrint and the
+ * conversion instructions both round to nearest even.
+ */
+#if defined(__SSE2__)
+static inline __m128d hnorm2(__m128d zr,__m128d zi,__m128d hx,__m128d hy)
+{
+  __m128d dr,di;
+  dr=_mm_sub_pd(zr,_mm_sub_pd(hx,_mm_mul_pd(hy,_mm_set1_pd(0.5))));
+  di=_mm_sub_pd(zi,_mm_mul_pd(hy,_mm_set1_pd(M_SQRT_3_4)));
+  return _mm_add_pd(_mm_mul_pd(dr,dr),_mm_mul_pd(di,di));
+}
+
+static inline __m128d select2(__m128d mask,__m128d a,__m128d b)
+{
+  return _mm_or_pd(_mm_and_pd(mask,a),_mm_andnot_pd(mask,b));
+}
+
+static inline void htry2(__m128d zr,__m128d zi,__m128d &hx,__m128d &hy,__m128d &norm0,double dx,double dy)
+{
+  __m128d hx1,hy1,norm1,back;
+  hx1=_mm_add_pd(hx,_mm_set1_pd(dx));
+  hy1=_mm_add_pd(hy,_mm_set1_pd(dy));
+  norm1=hnorm2(zr,zi,hx1,hy1);
+  back=_mm_cmpgt_pd(norm1,norm0);
+  hx=select2(back,hx,hx1);
+  hy=select2(back,hy,hy1);
+  norm0=select2(back,norm0,norm1);
+}
+#endif
+
+void roundhvecs(const double *x,const double *y,int n,hvec *lattice,complex<double> *frac)
+/* Rounds the n points x[i]+y[i]i to the nearest hvec, exactly as hvec(complex)
+ * does, and returns the difference between each point and its lattice point.
+ * Two points at a time with SSE2, and one at a time otherwise.
+ */
+{
+  int i=0,k;
+#if defined(__SSE2__)
+  __m128d zr,zi,hx,hy,norm;
+  alignas(16) double hxs[2],hys[2],dr[2],di[2];
+  for (;i+2<=n;i+=2)
+  {
+    zr=_mm_loadu_pd(x+i);
+    zi=_mm_loadu_pd(y+i);
+    hy=_mm_cvtepi32_pd(_mm_cvtpd_epi32(_mm_div_pd(zi,_mm_set1_pd(M_SQRT_3_4))));
+    hx=_mm_cvtepi32_pd(_mm_cvtpd_epi32(_mm_add_pd(zr,_mm_mul_pd(hy,_mm_set1_pd(0.5)))));
+    norm=hnorm2(zr,zi,hx,hy);
+    htry2(zr,zi,hx,hy,norm,0,1);
+    htry2(zr,zi,hx,hy,norm,-1,-1);
+    htry2(zr,zi,hx,hy,norm,0,-1);
+    htry2(zr,zi,hx,hy,norm,1,1);
+    _mm_store_pd(hxs,hx);
+    _mm_store_pd(hys,hy);
+    _mm_store_pd(dr,_mm_sub_pd(zr,_mm_sub_pd(hx,_mm_mul_pd(hy,_mm_set1_pd(0.5)))));
+    _mm_store_pd(di,_mm_sub_pd(zi,_mm_mul_pd(hy,_mm_set1_pd(M_SQRT_3_4))));
+    for (k=0;k<2;k++)
+    {
+      lattice[i+k]=hvec((int)hxs[k],(int)hys[k]);
+      frac[i+k]=complex<double>(dr[k],di[k]);
+    }
+  }
+#endif
+  for (;i<n;i++)
+  {
+    lattice[i]=complex<double>(x[i],y[i]);
+    frac[i]=complex<double>(x[i],y[i])-(complex<double>)lattice[i];
+  }
+}
+
 void hvec::divmod(hvec b)
 /* Division and remainder, done together to save time
  * 1     denx       deny
@@ -293,10 +372,16 @@ unsigned long hvec::norm()
 {return sqr(this->x)+sqr(this->y)-this->x*this->y;
  }
 
-hvec nthhvec(int n,int size,int nelts)
+int hvec::radius()
+// Radius of the smallest hexagon, as iterated by start, inc, and cont, that contains this.
+{
+  return max(max(abs(x),abs(y)),abs(x-y));
+}
+
+static hvec nthhvecRows(int n,int size,int nelts)
+// Finds the nth hvec by walking the rows.
 {
   int x,y,row;
-  assert (n>=0 && n<nelts);
   n-=nelts/2;
   if (n<0)
   {
@@ -318,6 +403,48 @@ hvec nthhvec(int n,int size,int nelts)
   return a;
 }
 
+/* Tables of nthhvec for each hexagon size up to NTHTABLERAD, built the first
+ * time each is needed and kept for the life of the program. Once built,
+ * a table is read without locking.
+ */
+static atomic<const hvec *> hexTables[NTHTABLERAD+1];
+static mutex hexTableMutex;
+
+static const hvec *hexagonTable(int size)
+{
+  const hvec *ret=hexTables[size].load(memory_order_acquire);
+  vector<hvec> *table;
+  int i,nelts;
+  if (!ret)
+  {
+    hexTableMutex.lock();
+    ret=hexTables[size].load(memory_order_acquire);
+    if (!ret)
+    {
+      nelts=3*size*(size+1)+1;
+      table=new vector<hvec>(nelts);
+      for (i=0;i<nelts;i++)
+	(*table)[i]=nthhvecRows(i,size,nelts);
+      ret=table->data();
+      hexTables[size].store(ret,memory_order_release);
+    }
+    hexTableMutex.unlock();
+  }
+  return ret;
+}
+
+hvec nthhvec(int n,int size,int nelts)
+/* Inverse of pageinx: the nth hvec, in the order of start, inc, and cont,
+ * in the hexagon of radius size, which has nelts elements.
+ */
+{
+  assert (n>=0 && n<nelts);
+  if (size>=0 && size<=NTHTABLERAD && nelts==3*size*(size+1)+1)
+    return hexagonTable(size)[n];
+  else
+    return nthhvecRows(n,size,nelts);
+}
+
 int hvec::pageinx(int size,int nelts)
 // Index to a byte within a page of specified size. Used in the inverse
 // letter table as well as the paging of harray.
@@ -379,6 +506,365 @@ int hvec::letterinx()
     }
  }
 
+static vector<int> pageCrcFill()
+{
+  vector<int> ret(PAGESIZE);
+  int i;
+  for (i=0;i<PAGESIZE;i++)
+    ret[i]=crcpos(nthhvec(i,PAGERAD,PAGESIZE));
+  return ret;
+}
+
+const int *pageCrcOffsets()
+/* Position in the PN sequence of each element of a page, relative to the
+ * page's center. As crcpos is linear, the position of element i of page q
+ * is crcpos(q*PAGEMOD)+pageCrcOffsets()[i], mod 8191.
+ */
+{
+  static const vector<int> offsets=pageCrcFill();
+  return offsets.data();
+}
+
+atomic<long> pageMallocs(0); // calls to malloc for harray pages or slabs of them
+
+pagearena::pagearena(int pagebytes,int pagesperslab)
+{
+  // Round up so that every page in a slab is aligned like the first.
+  blocksize=(PAGEHEAD+pagebytes+PAGEHEAD-1)/PAGEHEAD*PAGEHEAD;
+  slabpages=pagesperslab;
+  freelist=NULL;
+}
+
+pagearena::~pagearena()
+{
+  int i;
+  for (i=0;i<slabs.size();i++)
+    free(slabs[i]);
+}
+
+void pagearena::addSlab()
+// Call with the mutex locked.
+{
+  char *slab;
+  int i;
+  slab=(char *)malloc(blocksize*slabpages);
+  pageMallocs++;
+  slabs.push_back(slab);
+  for (i=slabpages-1;i>=0;i--)
+  {
+    *(char **)(slab+i*blocksize)=freelist;
+    freelist=slab+i*blocksize;
+  }
+}
+
+void *pagearena::alloc()
+{
+  char *block;
+  arenaMutex.lock();
+  if (!freelist)
+    addSlab();
+  block=freelist;
+  freelist=*(char **)block;
+  arenaMutex.unlock();
+  memset(block,0,blocksize);
+  return block;
+}
+
+void pagearena::release(void *block)
+{
+  arenaMutex.lock();
+  *(char **)block=freelist;
+  freelist=(char *)block;
+  arenaMutex.unlock();
+}
+
+void pagearena::reset()
+{
+  int i,j;
+  arenaMutex.lock();
+  freelist=NULL;
+  for (i=slabs.size()-1;i>=0;i--)
+    for (j=slabpages-1;j>=0;j--)
+    {
+      *(char **)(slabs[i]+j*blocksize)=freelist;
+      freelist=slabs[i]+j*blocksize;
+    }
+  arenaMutex.unlock();
+}
+
+/* Bit-packed harray. Each pageslot holds its page; a slot whose page
+ * has been pruned keeps its key and is marked not present.
+ */
+
+// The 12 bits of a letter, relative to its center, in the order of drawletter.
+static const hvec letterOffsets[12]=
+{
+  hvec( 0,-2),hvec(-1,-2),hvec(-2,-2),hvec( 1,-1),hvec( 0,-1),hvec(-1,-1),
+  hvec(-2,-1),hvec( 1, 0),hvec( 0, 0),hvec(-1, 0),hvec( 1, 1),hvec( 0, 1)
+};
+
+static vector<signed char> letterGatherFill()
+/* For each place in a page where a letter center can be, the pageinx of
+ * each of the letter's 12 bits, or -1 in the first entry if the letter
+ * sticks out of the page.
+ */
+{
+  vector<signed char> table(PAGESIZE*12);
+  hvec center,bit;
+  int i,k;
+  for (i=0;i<PAGESIZE;i++)
+  {
+    center=nthhvec(i,PAGERAD,PAGESIZE);
+    for (k=0;k<12;k++)
+    {
+      bit=center+letterOffsets[k];
+      table[i*12+k]=bit.radius()>PAGERAD?-1:bit.pageinx();
+    }
+    for (k=0;k<12;k++)
+      if (table[i*12+k]<0)
+	table[i*12]=-1;
+  }
+  return table;
+}
+
+static const signed char *letterGather()
+{
+  static const vector<signed char> table=letterGatherFill();
+  return table.data();
+}
+
+harray<bool>::harray()
+{
+  tablebits=nused=0;
+}
+
+int harray<bool>::slotinx(hvec q) const
+{
+  int i,mask=table.size()-1;
+  for (i=hashhvec(q,tablebits);table[i].used && q!=table[i].key;i=(i+1)&mask);
+  return i;
+}
+
+const uint64_t *harray<bool>::findPage(hvec q) const
+{
+  int i;
+  if (table.size())
+  {
+    i=slotinx(q);
+    if (table[i].present)
+      return table[i].bits;
+  }
+  return NULL;
+}
+
+void harray<bool>::rehash(int bits)
+{
+  vector<pageslot> oldtable;
+  int i;
+  oldtable.swap(table);
+  tablebits=bits;
+  table.resize(1<<bits);
+  for (i=0;i<table.size();i++)
+    table[i].used=table[i].present=false;
+  for (i=0;i<oldtable.size();i++)
+    if (oldtable[i].used)
+      table[slotinx(oldtable[i].key)]=oldtable[i];
+}
+
+uint64_t *harray<bool>::makePage(hvec q)
+{
+  int i;
+  if (2*(nused+1)>(int)table.size())
+    rehash(tablebits?tablebits+1:4);
+  i=slotinx(q);
+  if (!table[i].used)
+  {
+    table[i].key=q;
+    table[i].used=true;
+    nused++;
+  }
+  if (!table[i].present)
+  {
+    memset(table[i].bits,0,sizeof(table[i].bits));
+    table[i].present=true;
+    table[i].crc=0;
+  }
+  table[i].dirty=true;
+  return table[i].bits;
+}
+
+harray<bool>::reference harray<bool>::operator[](hvec i)
+{
+  hvec q,r;
+  int inx;
+  hdivmod<PageMod>(i,q,r);
+  inx=r.pageinx();
+  return reference(makePage(q)+(inx>>6),inx&63);
+}
+
+char harray<bool>::get(hvec i) const
+{
+  hvec q,r;
+  int inx;
+  const uint64_t *page;
+  hdivmod<PageMod>(i,q,r);
+  page=findPage(q);
+  inx=r.pageinx();
+  return page?(page[inx>>6]>>(inx&63))&1:0;
+}
+
+int harray<bool>::letterBits(hvec place) const
+// Reads the letter at place, in letter coordinates, like readglyph.
+{
+  hvec q,r;
+  const signed char *gather;
+  const uint64_t *page;
+  int k,inx,ret=0;
+  place*=LETTERMOD;
+  hdivmod<PageMod>(place,q,r);
+  gather=letterGather()+r.pageinx()*12;
+  if (gather[0]<0)
+  {
+    for (k=0;k<12;k++)
+      ret|=get(place+letterOffsets[k])<<k;
+    return ret;
+  }
+  page=findPage(q);
+  for (k=0;page && k<12;k++)
+  {
+    inx=gather[k];
+    ret|=((page[inx>>6]>>(inx&63))&1)<<k;
+  }
+  return ret;
+}
+
+void harray<bool>::putLetterBits(hvec place,int bits)
+// Writes the letter at place, in letter coordinates, like drawletter.
+{
+  hvec q,r;
+  const signed char *gather;
+  uint64_t *page;
+  int k,inx;
+  place*=LETTERMOD;
+  hdivmod<PageMod>(place,q,r);
+  gather=letterGather()+r.pageinx()*12;
+  if (gather[0]<0)
+    for (k=0;k<12;k++)
+      (*this)[place+letterOffsets[k]]=(bits>>k)&1;
+  else
+  {
+    page=makePage(q);
+    for (k=0;k<12;k++)
+    {
+      inx=gather[k];
+      if ((bits>>k)&1)
+	page[inx>>6]|=1ULL<<(inx&63);
+      else
+	page[inx>>6]&=~(1ULL<<(inx&63));
+    }
+  }
+}
+
+vector<hvec> harray<bool>::listPages() const
+{
+  int i;
+  vector<hvec> ret;
+  for (i=0;i<table.size();i++)
+    if (table[i].present)
+      ret.push_back(table[i].key);
+  sort(ret.begin(),ret.end());
+  return ret;
+}
+
+vector<char> harray<bool>::getPage(hvec q)
+{
+  const uint64_t *page=findPage(q);
+  vector<char> ret(PAGESIZE,0);
+  int i;
+  for (i=0;page && i<PAGESIZE;i++)
+    ret[i]=(page[i>>6]>>(i&63))&1;
+  return ret;
+}
+
+void harray<bool>::putPage(hvec q,vector<char> pagevec)
+{
+  uint64_t *page;
+  int i;
+  assert(pagevec.size()>=PAGESIZE);
+  page=makePage(q);
+  memset(page,0,PAGEWORDS*sizeof(uint64_t));
+  for (i=0;i<PAGESIZE;i++)
+    page[i>>6]|=(uint64_t)(pagevec[i]&1)<<(i&63);
+}
+
+int harray<bool>::computeCrc(hvec q,const uint64_t *bits) const
+/* Only the set bits contribute to the CRC, so this skips zero words
+ * and finds the set bits in the others.
+ */
+{
+  const int *offsets=pageCrcOffsets();
+  uint64_t word;
+  int i,bit,base,ret=0;
+  base=crcpos(q*PAGEMOD);
+  for (i=0;i<PAGEWORDS;i++)
+    for (word=bits[i];word;word&=word-1)
+    {
+      bit=__builtin_ctzll(word);
+      ret^=pncode[(base+offsets[i*64+bit])%8191][1];
+    }
+  return ret;
+}
+
+int harray<bool>::pageCrc(hvec q) const
+/* The CRC is cached until the page is written. operator[] dirties the page
+ * each time, but a reference kept across pageCrc does not; see harray.
+ */
+{
+  int j;
+  if (!table.size())
+    return 0;
+  j=slotinx(q);
+  if (!table[j].present)
+    return 0;
+  if (table[j].dirty)
+  {
+    table[j].crc=computeCrc(q,table[j].bits);
+    table[j].dirty=false;
+  }
+  else
+    assert(table[j].crc==computeCrc(q,table[j].bits));
+  return table[j].crc;
+}
+
+int harray<bool>::crc() const
+{
+  vector<hvec> pglist=listPages();
+  int i,ret=0;
+  for (i=0;i<pglist.size();i++)
+    ret^=pageCrc(pglist[i]);
+  return ret;
+}
+
+void harray<bool>::clear()
+{
+  table.clear();
+  tablebits=nused=0;
+}
+
+void harray<bool>::prune()
+{
+  int i,j;
+  bool zero;
+  for (i=0;i<table.size();i++)
+    if (table[i].present)
+    {
+      for (zero=true,j=0;j<PAGEWORDS;j++)
+	zero&=table[i].bits[j]==0;
+      if (zero)
+	table[i].present=false;
+    }
+}
+
 void testpageinx()
 {
   int x,y;
@@ -411,6 +897,39 @@ void testpageinx()
     }
     printf("\n");
   }
+  for (x=0;x<=NTHTABLERAD;x+=7)
+    for (y=0,h=start(x);h.cont(x);h.inc(x),y++)
+    {
+      assert(h.pageinx(x,3*x*(x+1)+1)==y);
+      assert(nthhvec(y,x,3*x*(x+1)+1)==h);
+    }
+}
+
+void benchdivmod()
+// Times hdivmod against the general division for PAGEMOD.
+{
+  hvec a,q0,r0,q1,r1;
+  int n=400;
+  long long sum0=0,sum1=0;
+  chrono::steady_clock::time_point t0,t1,t2;
+  t0=chrono::steady_clock::now();
+  for (a=start(n);a.cont(n);a.inc(n))
+  {
+    q0=a/PAGEMOD;
+    r0=a%PAGEMOD;
+    sum0+=q0.getx()+r0.gety();
+  }
+  t1=chrono::steady_clock::now();
+  for (a=start(n);a.cont(n);a.inc(n))
+  {
+    hdivmod<PageMod>(a,q1,r1);
+    sum1+=q1.getx()+r1.gety();
+  }
+  t2=chrono::steady_clock::now();
+  printf("divmod by PAGEMOD: general %.1f ns, hdivmod %.1f ns%s\n",
+	 chrono::duration<double,nano>(t1-t0).count()/(3*n*(n+1)+1),
+	 chrono::duration<double,nano>(t2-t1).count()/(3*n*(n+1)+1),
+	 (sum0==sum1)?"":", results differ");
 }
 
 int region(complex<double> z)
@@ -650,3 +1169,207 @@ void testsixvec()
   pstrailer();
   psclose();
 }
+
+void testroundhvecs()
+/* Checks roundhvecs against hvec(complex) on random points and on the
+ * vertices and edge midpoints of the hexagons, where ties are broken.
+ */
+{
+  vector<double> x,y;
+  vector<hvec> lattice;
+  vector<complex<double> > frac;
+  complex<double> z;
+  hvec h;
+  int i,n,errors=0;
+  for (i=0;i<10000;i++)
+  {
+    x.push_back((rand()-RAND_MAX/2.)/RAND_MAX*100);
+    y.push_back((rand()-RAND_MAX/2.)/RAND_MAX*100);
+  }
+  for (h=start(5);h.cont(5);h.inc(5))
+    for (i=0;i<12;i++)
+    {
+      z=(complex<double>)h+polar(i&1?0.5:M_SQRT_1_3,i*M_PI/6);
+      x.push_back(z.real());
+      y.push_back(z.imag());
+    }
+  n=x.size();
+  lattice.resize(n);
+  frac.resize(n);
+  roundhvecs(x.data(),y.data(),n,lattice.data(),frac.data());
+  for (i=0;i<n;i++)
+  {
+    z=complex<double>(x[i],y[i]);
+    h=z;
+    if (h!=lattice[i] || z-(complex<double>)h!=frac[i])
+      errors++;
+  }
+  printf("roundhvecs: %d points, %d errors\n",n,errors);
+  tassert(errors==0);
+}
+
+void testcursor()
+// Checks that hcursor visits the same places as start/inc/cont and finds the same elements.
+{
+  harray<int> arr;
+  hcursor<int> c(arr,30);
+  hvec h;
+  int n,errors=0;
+  for (h=start(40);h.cont(40);h.inc(40))
+    if (h.getx()%3)
+      arr[h]=h.getx()*1000+h.gety();
+  for (h=start(30),n=0;h.cont(30);h.inc(30),c.inc(),n++)
+    if (!c.cont() || c.where()!=h || c.get()!=arr.get(h) || *c!=arr[h])
+      errors++;
+  if (c.cont())
+    errors++;
+  printf("hcursor: %d elements, %d errors\n",n,errors);
+  tassert(errors==0);
+}
+
+void testbitarray()
+/* Checks the bit-packed harray against harray<char>: single bits, letters
+ * (including those that straddle pages), pages, and CRC.
+ */
+{
+  harray<bool> bits;
+  harray<char> bytes;
+  hvec h;
+  int k,n,letter,errors=0;
+  for (h=start(20),n=0;h.cont(20);h.inc(20),n++)
+  {
+    letter=rand()&4095;
+    bits.putLetterBits(h,letter);
+    for (k=0;k<12;k++)
+      bytes[h*LETTERMOD+letterOffsets[k]]=(letter>>k)&1;
+    if (bits.letterBits(h)!=letter)
+      errors++;
+  }
+  for (h=start(80);h.cont(80);h.inc(80))
+    if (bits.get(h)!=bytes.get(h))
+      errors++;
+  if (bits.crc()!=bytes.crc() || bits.listPages().size()!=bytes.listPages().size())
+    errors++;
+  printf("harray<bool>: %d letters, %d errors\n",n,errors);
+  tassert(errors==0);
+}
+
+void testcow()
+/* Checks that copies of an harray share pages until one of them is written,
+ * also by an hcursor that wrote before the copy or before clear.
+ */
+{
+  harray<char> a,b,c;
+  hvec h;
+  int errors=0;
+  for (h=start(20);h.cont(20);h.inc(20))
+    a[h]=h.getx()+h.gety();
+  b=a;
+  c=b;
+  b[hvec(3,4)]=100;
+  c[hvec(-3,-4)]=101;
+  for (h=start(20);h.cont(20);h.inc(20))
+  {
+    if (a.get(h)!=(char)(h.getx()+h.gety()))
+      errors++;
+    if (b.get(h)!=(h==hvec(3,4)?100:(char)(h.getx()+h.gety())))
+      errors++;
+    if (c.get(h)!=(h==hvec(-3,-4)?101:(char)(h.getx()+h.gety())))
+      errors++;
+  }
+  a.clear();
+  if (b.crc()==c.crc() || b.get(hvec(5,5))!=10)
+    errors++;
+  hcursor<char> cur(a,1);
+  *cur=1;
+  b=a;
+  *cur=2;
+  if (b.get(cur.where())!=1 || a.get(cur.where())!=2)
+    errors++;
+  a.clear();
+  *cur=3;
+  if (a.get(cur.where())!=3)
+    errors++;
+  printf("Copy on write: %d errors\n",errors);
+  tassert(errors==0);
+}
+
+void benchArena()
+/* Makes a thousand letter canvases of size 30, as if making a thousand
+ * symbols, with and without an arena, and counts the mallocs.
+ */
+{
+  pagearena arena(PAGESIZE);
+  harray<char> plain,slab(&arena);
+  hvec h;
+  int i;
+  long mallocs0,mallocs1,mallocs2;
+  chrono::steady_clock::time_point t0,t1,t2;
+  mallocs0=pageMallocs;
+  t0=chrono::steady_clock::now();
+  for (i=0;i<1000;i++)
+  {
+    for (h=start(30);h.cont(30);h.inc(30))
+      plain[h]=i;
+    plain.clear();
+  }
+  mallocs1=pageMallocs;
+  t1=chrono::steady_clock::now();
+  for (i=0;i<1000;i++)
+  {
+    for (h=start(30);h.cont(30);h.inc(30))
+      slab[h]=i;
+    slab.clear();
+    arena.reset();
+  }
+  mallocs2=pageMallocs;
+  t2=chrono::steady_clock::now();
+  printf("1000 canvases: %ld page mallocs in %.3f s without arena, %ld in %.3f s with arena\n",
+	 mallocs1-mallocs0,chrono::duration<double>(t1-t0).count(),
+	 mallocs2-mallocs1,chrono::duration<double>(t2-t1).count());
+}
+
+void testcrccache()
+/* Checks the cached CRCs against a CRC computed element by element, after
+ * writing through set, operator[], and hcursor between calls to crc.
+ */
+{
+  harray<char> arr;
+  harray<bool> bits;
+  const harray<char> &carr=arr;
+  const harray<bool> &cbits=bits;
+  hvec h;
+  int i,ref,errors=0;
+  for (i=0;i<4;i++)
+  {
+    for (h=start(30);h.cont(30);h.inc(30))
+      switch (i)
+      {
+	case 0:
+	  arr[h]=rand();
+	  bits[h]=arr.get(h);
+	  break;
+	case 1:
+	  if ((rand()&15)==0)
+	    arr.set(h,rand());
+	  break;
+	case 2:
+	  if ((rand()&15)==0)
+	    bits[h]=arr[h]=rand();
+	  break;
+      }
+    if (i==3)
+      for (hcursor<char> c(arr,10);c.cont();c.inc())
+	*c=0;
+    for (h=start(30),ref=0;h.cont(30);h.inc(30))
+      ref^=crc(arr.get(h),h);
+    if (arr.crc()!=ref || carr.crc()!=ref)
+      errors++;
+    for (h=start(30),ref=0;h.cont(30);h.inc(30))
+      ref^=crc(bits.get(h)&1,h);
+    if (bits.crc()!=ref || cbits.crc()!=ref)
+      errors++;
+  }
+  printf("Cached CRC: %d errors\n",errors);
+  tassert(errors==0);
+}
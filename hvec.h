@@ -34,9 +34,17 @@ class hvec;
 #include <cstring>
 #include <cassert>
 #include <vector>
+#include <array>
 #include <map>
+#include <algorithm>
 #include <complex>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <new>
 #include "pn8191.h"
+#include "mthreads.h"
 
 #define M_SQRT_3_4 0.86602540378443864676372317
 // The continued fraction expansion is 0;1,6,2,6,2,6,2,...
@@ -47,6 +55,9 @@ class hvec;
 // The maximum is 147 because of the file format.
 #define PAGERAD 6
 #define PAGESIZE (PAGERAD*(PAGERAD+1)*3+1)
+#define PAGEWORDS ((PAGESIZE+63)/64)
+#define NTHTABLERAD 127 // nthhvec uses a table for hexagons up to this size
+#define PAGEHEAD 16 // room for a page's pagehead, keeping the page aligned
 #define sqr(a) ((a)*(a))
 extern const std::complex<double> omega,ZLETTERMOD;
 
@@ -79,6 +90,7 @@ public:
   bool operator!=(hvec b);
   friend bool operator<(const hvec a,const hvec b); // only for the map
   unsigned long norm();
+  int radius();
   int pageinx(int size,int nelts);
   int pageinx();
   int letterinx();
@@ -98,6 +110,7 @@ public:
 
 hvec start(int n);
 hvec nthhvec(int n,int size,int nelts);
+void roundhvecs(const double *x,const double *y,int n,hvec *lattice,std::complex<double> *frac);
 extern const hvec LETTERMOD,PAGEMOD;
 extern int debughvec;
 
@@ -117,85 +130,476 @@ public:
   double norm();
 };
 
+template <int X,int Y> struct hconst
+// An Eisenstein integer known at compile time, for use as a divisor in hdivmod.
+{
+  static const int x=X,y=Y,norm=X*X+Y*Y-X*Y;
+  /* Bounding box of the parallelogram spanned by the divisor d and dω,
+   * which contains the remainder of the rough division.
+   */
+  static const int minx=std::min(std::min(0,X),std::min(-Y,X-Y));
+  static const int maxx=std::max(std::max(0,X),std::max(-Y,X-Y));
+  static const int miny=std::min(std::min(0,Y),std::min(X-Y,X));
+  static const int maxy=std::max(std::max(0,Y),std::max(X-Y,X));
+  static const int width=maxx-minx+1,height=maxy-miny+1;
+};
+
+typedef hconst<PAGERAD+1,2*PAGERAD+1> PageMod;
+typedef hconst<-2,-4> LetterMod;
+typedef hconst<2,0> TwoMod;
+
+inline int floordiv(int n,int d)
+// d is positive. When d is a constant, the compiler turns the division into a multiplication.
+{
+  return (n>=0)?n/d:-((d-1-n)/d);
+}
+
+constexpr int roundquo(int n,int d)
+// n/d rounded to nearest, halves away from zero, as round does. d is positive.
+{
+  return (n>=0)?(2*n+d)/(2*d):-((d-2*n)/(2*d));
+}
+
+constexpr int hnormxy(int x,int y)
+{
+  return x*x+y*y-x*y;
+}
+
+constexpr void hdivquo(int nx,int ny,int dx,int dy,int &qx,int &qy)
+/* The quotient of nx+nyω by dx+dyω, computed as hvec::divmod does, with
+ * integers only so that it can fill tables at compile time: the rough
+ * quotient, then the same nine steps, the first six taken if they make the
+ * remainder smaller and the last three if they don't make it bigger.
+ */
+{
+  const int step[9][4]=
+  {
+    {dx-dy,dx,-1,-1},{dy,dy-dx,0,1},{-dx,-dy,1,0},
+    {dy-dx,-dx,1,1},{-dy,dx-dy,0,-1},{dx,dy,-1,0},
+    {dx,dy,-1,0},{dx-dy,dx,-1,-1},{dy,dy-dx,0,1}
+  };
+  int nrm=hnormxy(dx,dy),rx=0,ry=0,nrm1=0,i=0;
+  qx=roundquo(nx*dx+ny*dy-nx*dy,nrm);
+  qy=roundquo(ny*dx-nx*dy,nrm);
+  rx=nx-dx*qx+dy*qy;
+  ry=ny-dx*qy-dy*qx+dy*qy;
+  for (i=0;i<9;i++)
+  {
+    nrm=hnormxy(rx,ry);
+    nrm1=hnormxy(rx+step[i][0],ry+step[i][1]);
+    if (nrm1<nrm || (i>=6 && nrm1==nrm))
+    {
+      rx+=step[i][0];
+      ry+=step[i][1];
+      qx+=step[i][2];
+      qy+=step[i][3];
+    }
+  }
+}
+
+template <typename D> constexpr std::array<signed char,2*D::width*D::height> hdivfill()
+{
+  std::array<signed char,2*D::width*D::height> table{};
+  int x=0,y=0,i=0,qx=0,qy=0;
+  for (x=D::minx;x<=D::maxx;x++)
+    for (y=D::miny;y<=D::maxy;y++)
+    {
+      hdivquo(x,y,D::x,D::y,qx,qy);
+      i=2*((x-D::minx)*D::height+y-D::miny);
+      table[i]=qx;
+      table[i+1]=qy;
+    }
+  return table;
+}
+
+template <typename D> struct hdivtable
+/* The correction table for hdivmod<D>. For each point r0 in the
+ * parallelogram, it holds the quotient of r0 by D as computed by the
+ * general division, which is at most 2 in each coordinate. It's filled at
+ * compile time, so hdivmod reads it at a fixed address without a guard,
+ * even from another file's static initializers.
+ */
+{
+  static constexpr std::array<signed char,2*D::width*D::height> table=hdivfill<D>();
+};
+
+template <typename D> void hdivmod(hvec a,hvec &quo,hvec &rem)
+/* Divides a by the constant D, giving the same quotient and remainder as
+ * a/hvec(D::x,D::y) and a%hvec(D::x,D::y), using only integer arithmetic.
+ * The rough quotient is a times the conjugate of D, divided by the norm
+ * and rounded down; the remainder of that lies in the parallelogram, and
+ * the table, filled by the same steps as the general division, says how
+ * far to move it.
+ */
+{
+  int ax=a.getx(),ay=a.gety(),qx,qy,rx,ry,cx,cy,i;
+  qx=floordiv(ax*(D::x-D::y)+ay*D::y,D::norm);
+  qy=floordiv(ay*D::x-ax*D::y,D::norm);
+  rx=ax-qx*D::x+qy*D::y;
+  ry=ay-qx*D::y-qy*D::x+qy*D::y;
+  i=2*((rx-D::minx)*D::height+ry-D::miny);
+  cx=hdivtable<D>::table[i];
+  cy=hdivtable<D>::table[i+1];
+  quo=hvec(qx+cx,qy+cy);
+  rem=hvec(rx-cx*D::x+cy*D::y,ry-cx*D::y-cy*D::x+cy*D::y);
+}
+
+template <typename D> int checkdivmod(int n)
+/* Returns how many points in a hexagon of radius n hdivmod<D> gets wrong,
+ * plus how many entries of its table differ from the general division.
+ */
+{
+  hvec a,d(D::x,D::y),q,r;
+  int x,y,i,errors=0;
+  for (a=start(n);a.cont(n);a.inc(n))
+  {
+    hdivmod<D>(a,q,r);
+    if (q!=a/d || r!=a%d)
+      errors++;
+  }
+  for (x=D::minx;x<=D::maxx;x++)
+    for (y=D::miny;y<=D::maxy;y++)
+    {
+      q=hvec(x,y)/d;
+      i=2*((x-D::minx)*D::height+y-D::miny);
+      if (q.getx()!=hdivtable<D>::table[i] || q.gety()!=hdivtable<D>::table[i+1])
+	errors++;
+    }
+  return errors;
+}
+
+class pagearena
+/* Slabs of harray pages of one size, with a free list. Pages are handed
+ * out zeroed. reset makes every page free at once, without returning the
+ * slabs to malloc; it may be called only when no harray still holds a page
+ * from the arena. The arena must outlive all pages allocated from it.
+ * alloc and release lock the arena, as pages may be released by any thread.
+ */
+{
+  int blocksize,slabpages;
+  std::vector<char *> slabs;
+  char *freelist;
+  std::mutex arenaMutex;
+  void addSlab();
+public:
+  pagearena(int pagebytes,int pagesperslab=64);
+  ~pagearena();
+  void *alloc();
+  void release(void *block);
+  void reset();
+  int pageBytes()
+  {return blocksize-PAGEHEAD;
+   }
+};
+
+struct pagehead
+// Precedes each harray page.
+{
+  std::atomic<int> refs;
+  pagearena *arena; // NULL if the page came from calloc
+};
+static_assert(sizeof(pagehead)<=PAGEHEAD && PAGEHEAD%alignof(std::max_align_t)==0,
+	      "PAGEHEAD must hold a pagehead and keep pages aligned");
+
+extern std::atomic<long> pageMallocs;
+const int *pageCrcOffsets();
+
 template <typename T> class harray
+/* Array subscripted by hvec, allocated in hexagonal pages of PAGESIZE
+ * elements as they are written. The page table is an open-addressing hash
+ * keyed on the packed quotient by PAGEMOD, with linear probing; a slot
+ * whose page has been pruned keeps its key, so nothing is ever deleted.
+ * operator[] allocates the page if needed and remembers the last page
+ * it found; get does neither, and may be called by several threads at once.
+ *
+ * Pages are reference-counted and copied on write. Copying an harray copies
+ * the page table and counts each page once more; operator[], putPage, and
+ * hcursor's * copy a shared page before handing it out. The count is atomic,
+ * so copies may go to other threads, but one harray must not be copied
+ * while being written. Copying, clearing, or pruning either array bumps
+ * crcgen, so that an hcursor that has written looks its page up again.
+ *
+ * An harray may be given a pagearena, from which it takes new pages. Each
+ * page remembers where it came from, so a page copied into another harray
+ * goes back to the right place.
+ *
+ * Each slot caches its page's CRC. Anything that hands out a writable page
+ * marks the slot dirty, and pageCrc recomputes only dirty pages. set writes
+ * one element and updates the cached CRC by XOR, without dirtying it.
+ * Cleaning a page bumps crcgen, so that hcursor and the memo in operator[]
+ * look the page up again, and dirty it again, before writing. A reference
+ * from operator[] or hcursor is therefore good for writing only until the
+ * next pageCrc or crc, like an iterator after a vector grows; writing
+ * through it afterwards leaves a stale CRC, which pageCrc asserts against
+ * by checking clean pages unless NDEBUG is defined.
+ */
 {
-  std::map<hvec,T *> index;
+  struct pageslot
+  {
+    hvec key;
+    T *page;
+    mutable int crc; // cached CRC of the page, valid unless dirty
+    bool used;
+    mutable bool dirty;
+  };
+  std::vector<pageslot> table; // size is 0 or a power of 2
+  int tablebits,nused;
+  mutable int crcgen;
+  mutable hvec lastq;
+  mutable T *lastpage; // reset by copying, since the page is then shared
+  pagearena *arena;
+  int slotinx(hvec q) const;
+  T *findPage(hvec q) const;
+  int makeSlot(hvec q);
+  T *makePage(hvec q);
+  void rehash(int bits);
+  T *newPage();
+  int computeCrc(hvec q,const T *page) const;
+  static pagehead *head(T *page)
+  {return (pagehead *)((char *)page-PAGEHEAD);
+   }
+  static void releasePage(T *page);
+  template <typename U> friend class hcursor;
 public:
-  harray()=default;
+  harray(pagearena *a=NULL);
   harray(const harray &h);
   harray &operator=(const harray &h);
   ~harray();
   T& operator[](hvec i);
-  std::vector<hvec> listPages();
+  T get(hvec i) const;
+  void set(hvec i,T val);
+  std::vector<hvec> listPages() const;
   std::vector<T> getPage(hvec q);
   void putPage(hvec q,std::vector<T> pagevec);
-  int pageCrc(hvec q);
-  int crc();
+  int pageCrc(hvec q) const;
+  int crc() const;
   void clear();
   void prune();
+  void setArena(pagearena *a);
 };
 
+inline unsigned hashhvec(hvec q,int bits)
+// Fibonacci hash of the packed hvec, giving a number less than 2**bits.
+{
+  unsigned long long packed;
+  packed=((unsigned long long)(unsigned)q.getx()<<32)|(unsigned)q.gety();
+  return bits?(packed*0x9e3779b97f4a7c15ULL)>>(64-bits):0;
+}
+
+template <typename T> harray<T>::harray(pagearena *a)
+{
+  tablebits=nused=crcgen=0;
+  lastpage=NULL;
+  arena=NULL;
+  setArena(a);
+}
+
 template <typename T> harray<T>::harray(const harray<T> &h)
+// The copy shares h's pages, but not its arena.
 {
-  typename std::map<hvec,T *>::const_iterator i;
-  for (i=h.index.begin();i!=h.index.end();i++)
-    if (i->second)
-    {
-      index[i->first]=(T*)calloc(PAGESIZE,sizeof(T));
-      memcpy(index[i->first],i->second,PAGESIZE*sizeof(T));
-    }
+  tablebits=nused=crcgen=0;
+  lastpage=NULL;
+  arena=NULL;
+  *this=h;
 }
 
 template <typename T> harray<T> &harray<T>::operator=(const harray<T> &h)
+// Shares h's pages. Neither array may write into them without copying them.
 {
-  typename std::map<hvec,T *>::const_iterator i;
+  int i;
   if (this==&h)
     return *this;
   clear();
-  for (i=h.index.begin();i!=h.index.end();i++)
-    if (i->second)
-    {
-      index[i->first]=(T*)calloc(PAGESIZE,sizeof(T));
-      memcpy(index[i->first],i->second,PAGESIZE*sizeof(T));
-    }
+  table=h.table;
+  tablebits=h.tablebits;
+  nused=h.nused;
+  for (i=0;i<table.size();i++)
+    if (table[i].page)
+      head(table[i].page)->refs++;
+  h.lastpage=NULL;
+  h.crcgen++;
   return *this;
 }
 
+template <typename T> T *harray<T>::newPage()
+// Allocates a zeroed page with a reference count of 1.
+{
+  char *block;
+  pagehead *h;
+  if (arena)
+    block=(char *)arena->alloc();
+  else
+  {
+    block=(char *)calloc(1,PAGEHEAD+PAGESIZE*sizeof(T));
+    pageMallocs++;
+  }
+  h=new (block) pagehead;
+  h->refs=1;
+  h->arena=arena;
+  return (T *)(block+PAGEHEAD);
+}
+
+template <typename T> void harray<T>::releasePage(T *page)
+{
+  pagehead *h;
+  if (page && --head(page)->refs==0)
+  {
+    h=head(page);
+    if (h->arena)
+      h->arena->release(h);
+    else
+      free(h);
+  }
+}
+
+template <typename T> void harray<T>::setArena(pagearena *a)
+// New pages will come from a. Pages already allocated stay where they are.
+{
+  assert(!a || a->pageBytes()>=PAGESIZE*sizeof(T));
+  arena=a;
+}
+
 template <typename T> harray<T>::~harray<T>()
 {
   clear();
 }
 
+template <typename T> int harray<T>::slotinx(hvec q) const
+// Returns the slot holding q, or the empty slot where q would go.
+{
+  int i,mask=table.size()-1;
+  for (i=hashhvec(q,tablebits);table[i].used && q!=table[i].key;i=(i+1)&mask);
+  return i;
+}
+
+template <typename T> T *harray<T>::findPage(hvec q) const
+{
+  if (table.size())
+    return table[slotinx(q)].page;
+  else
+    return NULL;
+}
+
+template <typename T> void harray<T>::rehash(int bits)
+{
+  std::vector<pageslot> oldtable;
+  int i,j;
+  oldtable.swap(table);
+  tablebits=bits;
+  table.resize(1<<bits);
+  for (i=0;i<table.size();i++)
+  {
+    table[i].page=NULL;
+    table[i].used=false;
+  }
+  for (i=0;i<oldtable.size();i++)
+    if (oldtable[i].used)
+    {
+      j=slotinx(oldtable[i].key);
+      table[j]=oldtable[i];
+    }
+}
+
+template <typename T> int harray<T>::makeSlot(hvec q)
+/* Returns the slot of page q, allocating the page if it doesn't exist,
+ * and copying it if it is shared. Keeps the table at most half full.
+ */
+{
+  T *copy;
+  int i;
+  if (2*(nused+1)>(int)table.size())
+    rehash(tablebits?tablebits+1:4);
+  i=slotinx(q);
+  if (!table[i].used)
+  {
+    table[i].key=q;
+    table[i].used=true;
+    nused++;
+  }
+  if (!table[i].page)
+  {
+    table[i].page=newPage();
+    table[i].crc=0;
+    table[i].dirty=false;
+  }
+  else if (head(table[i].page)->refs>1)
+  {
+    copy=newPage();
+    memcpy(copy,table[i].page,PAGESIZE*sizeof(T));
+    releasePage(table[i].page);
+    table[i].page=copy;
+  }
+  return i;
+}
+
+template <typename T> T *harray<T>::makePage(hvec q)
+// Returns the page q, ready to write, and marks its CRC dirty.
+{
+  int i=makeSlot(q);
+  table[i].dirty=true;
+  return table[i].page;
+}
+
 template <typename T> T& harray<T>::operator[](hvec i)
 {
   hvec q,r;
-  q=i/PAGEMOD;
-  r=i%PAGEMOD;
-  if (!index[q])
-    index[q]=(T*)calloc(PAGESIZE,sizeof(T));
-  return index[q][r.pageinx()];
+  hdivmod<PageMod>(i,q,r);
+  if (!lastpage || q!=lastq)
+  {
+    lastpage=makePage(q);
+    lastq=q;
+  }
+  return lastpage[r.pageinx()];
+}
+
+template <typename T> T harray<T>::get(hvec i) const
+// Returns 0 if the page doesn't exist.
+{
+  hvec q,r;
+  T *page;
+  hdivmod<PageMod>(i,q,r);
+  page=findPage(q);
+  return page?page[r.pageinx()]:0;
 }
 
-template <typename T> std::vector<hvec> harray<T>::listPages()
+template <typename T> void harray<T>::set(hvec i,T val)
+// Writes one element, keeping the page's CRC up to date.
 {
-  typename std::map<hvec,T *>::iterator i;
+  hvec q,r;
+  int j,inx,ipos;
+  T *elt;
+  hdivmod<PageMod>(i,q,r);
+  j=makeSlot(q);
+  inx=r.pageinx();
+  elt=table[j].page+inx;
+  if (!table[j].dirty && *elt!=val)
+  {
+    ipos=(crcpos(q*PAGEMOD)+pageCrcOffsets()[inx])%8191;
+    table[j].crc^=crcAt(*elt,ipos)^crcAt(val,ipos);
+  }
+  *elt=val;
+}
+
+template <typename T> std::vector<hvec> harray<T>::listPages() const
+// Returns the pages in order of y, then x.
+{
+  int i;
   std::vector<hvec> ret;
-  for (i=index.begin();i!=index.end();++i)
-    if (i->second)
-      ret.push_back(i->first);
+  for (i=0;i<table.size();i++)
+    if (table[i].page)
+      ret.push_back(table[i].key);
+  std::sort(ret.begin(),ret.end());
   return ret;
 }
 
 template <typename T> std::vector<T> harray<T>::getPage(hvec q)
+// A page that doesn't exist reads as zeros. It is not created.
 {
-  T *page;
-  std::vector<T> ret;
+  T *page=findPage(q);
+  std::vector<T> ret(PAGESIZE,0);
   int i;
-  if (!index[q]) // This shouldn't happen, as this is for getting a page that already exists.
-    index[q]=(T*)calloc(PAGESIZE,sizeof(T));
-  page=index[q];
-  for (i=0;i<PAGESIZE;i++)
-    ret.push_back(page[i]);
+  for (i=0;page && i<PAGESIZE;i++)
+    ret[i]=page[i];
   return ret;
 }
 
@@ -204,24 +608,47 @@ template <typename T> void harray<T>::putPage(hvec q,std::vector<T> pagevec)
   T *page;
   int i;
   assert(pagevec.size()>=PAGESIZE);
-  if (!index[q])
-    index[q]=(T*)calloc(PAGESIZE,sizeof(T));
-  page=index[q];
+  page=makePage(q);
   for (i=0;i<PAGESIZE;i++)
     page[i]=pagevec[i];
 }
 
-template <typename T> int harray<T>::pageCrc(hvec q)
+template <typename T> int harray<T>::computeCrc(hvec q,const T *page) const
 {
-  hvec center=q*PAGEMOD;
-  int i,ret=0;
-  T *page=index[q];
-  for (i=0;page && i<PAGESIZE;i++)
-    ret^=::crc(page[i],center+nthhvec(i,PAGERAD,PAGESIZE));
+  int i,base,ret=0;
+  const int *offsets;
+  base=crcpos(q*PAGEMOD);
+  offsets=pageCrcOffsets();
+  for (i=0;i<PAGESIZE;i++)
+    if (page[i])
+      ret^=crcAt(page[i],(base+offsets[i])%8191);
   return ret;
 }
 
-template <typename T> int harray<T>::crc()
+template <typename T> int harray<T>::pageCrc(hvec q) const
+// A clean page that doesn't match its CRC was written through a stale reference.
+{
+  int j;
+  const T *page;
+  if (!table.size())
+    return 0;
+  j=slotinx(q);
+  page=table[j].page;
+  if (!page)
+    return 0;
+  if (table[j].dirty)
+  {
+    table[j].crc=computeCrc(q,page);
+    table[j].dirty=false;
+    lastpage=NULL;
+    crcgen++;
+  }
+  else
+    assert(table[j].crc==computeCrc(q,page));
+  return table[j].crc;
+}
+
+template <typename T> int harray<T>::crc() const
 {
   std::vector<hvec> pglist=listPages();
   int i,ret=0;
@@ -232,33 +659,341 @@ template <typename T> int harray<T>::crc()
 
 template <typename T> void harray<T>::clear()
 {
-  typename std::map<hvec,T *>::iterator i;
-  for (i=index.begin();i!=index.end();++i)
-  {
-    free(i->second);
-    i->second=NULL;
-  }
-  index.clear();
+  int i;
+  for (i=0;i<table.size();i++)
+    releasePage(table[i].page);
+  table.clear();
+  tablebits=nused=0;
+  lastpage=NULL;
+  crcgen++;
 }
 
 template <typename T> void harray<T>::prune()
 {
-  typename std::map<hvec,T *>::iterator i;
+  int i;
   char *page;
-  for (i=index.begin();i!=index.end();++i)
+  for (i=0;i<table.size();i++)
   {
-    page=(char *)i->second;
-    if (*page==0 && memcmp(page,page+1,PAGESIZE*sizeof(T)-1)==0)
+    page=(char *)table[i].page;
+    if (page && *page==0 && memcmp(page,page+1,PAGESIZE*sizeof(T)-1)==0)
     {
-      free(i->second);
-      i->second=NULL;
+      releasePage(table[i].page);
+      table[i].page=NULL;
+      table[i].crc=0;
+      table[i].dirty=false;
     }
   }
+  lastpage=NULL;
+  crcgen++;
+}
+
+template <> class harray<bool>
+/* Bit-packed harray, used for hbits, which holds only the module colors.
+ * The marks made while tracing contours are in contour.cpp's tracegrid.
+ * A page is PAGEWORDS 64-bit words, in pageinx order, kept in the hash
+ * slot itself; moving the table moves the pages, so don't keep pointers
+ * into them. operator[] returns a reference to one bit. letterBits and
+ * putLetterBits read and write the 12 bits of a letter at once, in the
+ * order of drawletter, usually within one page.
+ */
+{
+  struct pageslot
+  {
+    hvec key;
+    uint64_t bits[PAGEWORDS];
+    mutable int crc; // cached CRC of the page, valid unless dirty
+    bool used,present;
+    mutable bool dirty;
+  };
+  std::vector<pageslot> table; // size is 0 or a power of 2
+  int tablebits,nused;
+  int slotinx(hvec q) const;
+  const uint64_t *findPage(hvec q) const;
+  uint64_t *makePage(hvec q);
+  void rehash(int bits);
+  int computeCrc(hvec q,const uint64_t *bits) const;
+public:
+  class reference
+  {
+    uint64_t *word;
+    uint64_t mask;
+  public:
+    reference(uint64_t *w,int bit)
+    {word=w;
+     mask=1ULL<<bit;
+     }
+    operator char() const
+    {return (*word&mask)!=0;
+     }
+    reference &operator=(int b)
+    {if (b&1)
+        *word|=mask;
+     else
+        *word&=~mask;
+     return *this;
+     }
+  };
+  harray();
+  reference operator[](hvec i);
+  char get(hvec i) const;
+  int letterBits(hvec place) const;
+  void putLetterBits(hvec place,int bits);
+  std::vector<hvec> listPages() const;
+  std::vector<char> getPage(hvec q);
+  void putPage(hvec q,std::vector<char> pagevec);
+  int pageCrc(hvec q) const;
+  int crc() const;
+  void clear();
+  void prune();
+};
+
+template <typename T> class hcursor
+/* Walks an harray over a hexagon of radius n, in the same order as
+ * for (i=start(n);i.cont(n);i.inc(n)). The remainder by PAGEMOD is kept
+ * as the cursor moves, and the page is looked up only when the remainder
+ * leaves the page hexagon. *c allocates the page, like harray::operator[];
+ * c.get() does not, and reads a missing page as 0.
+ */
+{
+  harray<T> *arr;
+  int rad;
+  hvec pos,q,r;
+  T *page;
+  int gen; // arr->crcgen when page was made writable
+  bool found;
+  void locate();
+public:
+  hcursor(harray<T> &a,int n);
+  hvec where()
+  {return pos;
+   }
+  bool cont()
+  {return pos.cont(rad);
+   }
+  void inc();
+  T& operator*();
+  T get();
+};
+
+template <typename T> hcursor<T>::hcursor(harray<T> &a,int n)
+{
+  arr=&a;
+  rad=n;
+  pos=start(n);
+  locate();
+}
+
+template <typename T> void hcursor<T>::locate()
+{
+  hdivmod<PageMod>(pos,q,r);
+  page=NULL;
+  gen=-1;
+  found=false;
+}
+
+template <typename T> void hcursor<T>::inc()
+{
+  hvec last=pos;
+  pos.inc(rad);
+  r+=pos-last;
+  if (r.radius()>PAGERAD)
+    locate();
+}
+
+template <typename T> T& hcursor<T>::operator*()
+{
+  if (!page || gen!=arr->crcgen)
+  {
+    page=arr->makePage(q);
+    gen=arr->crcgen;
+    found=true;
+  }
+  return page[r.pageinx()];
+}
+
+template <typename T> T hcursor<T>::get()
+{
+  if (!found)
+  {
+    page=arr->findPage(q);
+    found=true;
+  }
+  return page?page[r.pageinx()]:0;
+}
+
+template <typename T> class hgrid
+/* Dense array subscripted by hvec, covering a hexagon of fixed radius.
+ * Where harray divides by PAGEMOD and looks up the page in a map on every
+ * access, hgrid finds the element from a per-row offset table. Use it
+ * instead of harray when the bounds of the symbol are known. Subscripting
+ * outside the hexagon throws out_of_range; get returns 0 there.
+ */
+{
+  int rad;
+  std::vector<T> elts;
+  std::vector<int> rowoff; // subscript of (0,y) in elts, for y from -rad to rad
+public:
+  hgrid(int radius=0);
+  void resize(int radius);
+  int getRadius()
+  {return rad;
+   }
+  bool inside(hvec i)
+  {return i.radius()<=rad;
+   }
+  T& operator[](hvec i);
+  T get(hvec i)
+  {return inside(i)?elts[rowoff[i.gety()+rad]+i.getx()]:0;
+   }
+  template <typename A> void copyFrom(A &h);
+  std::vector<hvec> listPages();
+  std::vector<T> getPage(hvec q);
+  void putPage(hvec q,std::vector<T> pagevec);
+  int pageCrc(hvec q);
+  int crc();
+  void clear();
+};
+
+template <typename T> hgrid<T>::hgrid(int radius)
+{
+  resize(radius);
+}
+
+template <typename T> void hgrid<T>::resize(int radius)
+// Resizes and zeroes the grid. Row y runs from max(-rad,y-rad) to min(rad,y+rad).
+{
+  int y,n;
+  if (radius<0)
+    throw(std::out_of_range("hgrid: radius<0"));
+  rad=radius;
+  rowoff.resize(2*rad+1);
+  for (y=-rad,n=0;y<=rad;y++)
+  {
+    rowoff[y+rad]=n-((y<0)?-rad:y-rad);
+    n+=2*rad+1-abs(y);
+  }
+  elts.assign(n,0);
+}
+
+template <typename T> T& hgrid<T>::operator[](hvec i)
+{
+  if (!inside(i))
+    throw(std::out_of_range("hgrid: subscript outside hexagon"));
+  return elts[rowoff[i.gety()+rad]+i.getx()];
+}
+
+template <typename T> template <typename A> void hgrid<T>::copyFrom(A &h)
+/* Copies the part of h, which is an harray of T or of bool,
+ * that lies within the hexagon. The rest is zero.
+ */
+{
+  std::vector<hvec> pglist=h.listPages();
+  std::vector<T> page;
+  hvec center,pos;
+  int i,j;
+  clear();
+  for (i=0;i<pglist.size();i++)
+  {
+    center=pglist[i]*PAGEMOD;
+    if (center.radius()>rad+2*PAGERAD)
+      continue;
+    page=h.getPage(pglist[i]);
+    for (j=0;j<PAGESIZE;j++)
+    {
+      pos=center+nthhvec(j,PAGERAD,PAGESIZE);
+      if (inside(pos))
+	(*this)[pos]=page[j];
+    }
+  }
+}
+
+template <typename T> std::vector<hvec> hgrid<T>::listPages()
+/* Lists the pages, in the sense of harray, that overlap the hexagon,
+ * in the same order as harray::listPages.
+ */
+{
+  std::map<hvec,bool> pages;
+  typename std::map<hvec,bool>::iterator j;
+  std::vector<hvec> ret;
+  hvec i,q,r;
+  for (i=start(rad);i.cont(rad);i.inc(rad))
+  {
+    hdivmod<PageMod>(i,q,r);
+    pages[q]=true;
+  }
+  for (j=pages.begin();j!=pages.end();++j)
+    ret.push_back(j->first);
+  return ret;
+}
+
+template <typename T> std::vector<T> hgrid<T>::getPage(hvec q)
+{
+  std::vector<T> ret(PAGESIZE,0);
+  hvec center=q*PAGEMOD,pos;
+  int i;
+  for (i=0;i<PAGESIZE;i++)
+  {
+    pos=center+nthhvec(i,PAGERAD,PAGESIZE);
+    if (inside(pos))
+      ret[i]=(*this)[pos];
+  }
+  return ret;
+}
+
+template <typename T> void hgrid<T>::putPage(hvec q,std::vector<T> pagevec)
+// Elements of the page that lie outside the hexagon are dropped.
+{
+  hvec center=q*PAGEMOD,pos;
+  int i;
+  assert(pagevec.size()>=PAGESIZE);
+  for (i=0;i<PAGESIZE;i++)
+  {
+    pos=center+nthhvec(i,PAGERAD,PAGESIZE);
+    if (inside(pos))
+      (*this)[pos]=pagevec[i];
+  }
+}
+
+template <typename T> int hgrid<T>::pageCrc(hvec q)
+{
+  hvec center=q*PAGEMOD,pos;
+  int i,ret=0;
+  for (i=0;i<PAGESIZE;i++)
+  {
+    pos=center+nthhvec(i,PAGERAD,PAGESIZE);
+    if (inside(pos))
+      ret^=::crc((*this)[pos],pos);
+  }
+  return ret;
+}
+
+template <typename T> int hgrid<T>::crc()
+/* The CRC of an element is 0 if the element is 0, so this is the same
+ * as the CRC of an harray with the same contents.
+ */
+{
+  hvec i;
+  int ret=0;
+  for (i=start(rad);i.cont(rad);i.inc(rad))
+    ret^=::crc((*this)[i],i);
+  return ret;
+}
+
+template <typename T> void hgrid<T>::clear()
+{
+  elts.assign(elts.size(),0);
 }
 
 int region(std::complex<double> z);
 void testcomplex();
 void testsixvec();
 void testpageinx();
+void benchdivmod();
+void testroundhvecs();
+void testcursor();
+void testbitarray();
+void testcow();
+void benchArena();
+void testcrccache();
 
 #endif
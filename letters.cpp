@@ -55,13 +55,28 @@
 #include <vector>
 #include <cassert>
 #include <iostream>
+#include <mutex>
+#include <atomic>
+#include "config.h"
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include "letters.h"
+#include "invtable.h"
 #include "raster.h"
 #include "threads.h"
+#include "propolis.h"
 
 using namespace std;
 
-harray<char> hletters,hbits;
+harray<char> hletters;
+harray<bool> hbits;
 harray<uint16_t> hglyphs;
 
 uint16_t letters[38]={
@@ -210,6 +225,7 @@ const complex<double> ninedisp[]=
 };
 const short int weights[]={333,31,31,31,1812,31,31,31,333};
 vector<float> exp252tab;
+once_flag exp252once;
 
 int bitcount(int n)
 {
@@ -284,45 +300,19 @@ int invar12(int bitpattern)
   return inv;
 }
 
-void drawletter(int letter,hvec place,harray<char> &canvas)
+void drawletter(int letter,hvec place,harray<bool> &canvas)
 // letter is from 0x00 to 0x25; place is any hvec
 {
-  letter=letters[letter];
-  place*=LETTERMOD;
-  canvas[place+hvec( 0,-2)]=(letter>> 0)&1;
-  canvas[place+hvec(-1,-2)]=(letter>> 1)&1;
-  canvas[place+hvec(-2,-2)]=(letter>> 2)&1;
-  canvas[place+hvec( 1,-1)]=(letter>> 3)&1;
-  canvas[place+hvec( 0,-1)]=(letter>> 4)&1;
-  canvas[place+hvec(-1,-1)]=(letter>> 5)&1;
-  canvas[place+hvec(-2,-1)]=(letter>> 6)&1;
-  canvas[place+hvec( 1, 0)]=(letter>> 7)&1;
-  canvas[place+hvec( 0, 0)]=(letter>> 8)&1;
-  canvas[place+hvec(-1, 0)]=(letter>> 9)&1;
-  canvas[place+hvec( 1, 1)]=(letter>>10)&1;
-  canvas[place+hvec( 0, 1)]=(letter>>11)&1;
+  canvas.putLetterBits(place,letters[letter]);
 }
 
-int readglyph(hvec place,harray<char> &canvas)
-{
-  int glyph=0;
-  place*=LETTERMOD;
-  glyph+=(canvas[place+hvec( 0,-2)]&1)<< 0;
-  glyph+=(canvas[place+hvec(-1,-2)]&1)<< 1;
-  glyph+=(canvas[place+hvec(-2,-2)]&1)<< 2;
-  glyph+=(canvas[place+hvec( 1,-1)]&1)<< 3;
-  glyph+=(canvas[place+hvec( 0,-1)]&1)<< 4;
-  glyph+=(canvas[place+hvec(-1,-1)]&1)<< 5;
-  glyph+=(canvas[place+hvec(-2,-1)]&1)<< 6;
-  glyph+=(canvas[place+hvec( 1, 0)]&1)<< 7;
-  glyph+=(canvas[place+hvec( 0, 0)]&1)<< 8;
-  glyph+=(canvas[place+hvec(-1, 0)]&1)<< 9;
-  glyph+=(canvas[place+hvec( 1, 1)]&1)<<10;
-  glyph+=(canvas[place+hvec( 0, 1)]&1)<<11;
-  return glyph;
+int readglyph(hvec place,harray<bool> &canvas)
+{
+  return canvas.letterBits(place);
 }
 
-hvec roundframe(sixvec s)
+hvec roundframeBrute(sixvec s)
+// Reference for roundframe: tries every frame.
 {
   hvec h,closest;
   double norm,distance,mindist;
@@ -343,26 +333,233 @@ hvec roundframe(sixvec s)
   return closest;
 }
 
-InvLetterResult shiftFrame(harray<char> hletters,int i,int j,int k,int l)
+const vector<sixvec> &frameSixvecs()
+// The torus point of each frame, in the order of pageinx(FRAMERAD,FRAMESIZE).
 {
-  harray<char> hbits;
-  int m,n,t,il;
-  hvec disp;
-  complex<double> frame;
-  InvLetterResult ret;
-  ret.suminv=0;
-  for (disp=start(2);disp.cont(2);disp.inc(2))
-    drawletter(hletters[disp],disp,hbits);
-  for (n=0;n<9;n++)
-    for (t=0;t<12;t++)
+  static const vector<sixvec> table=[]()
+  {
+    vector<sixvec> ret;
+    hvec h;
+    for (h=start(FRAMERAD);h.cont(FRAMERAD);h.inc(FRAMERAD))
+      ret.push_back(sixvec((complex<double>)h/(complex<double>)FRAMEMOD));
+    return ret;
+  }();
+  return table;
+}
+
+const hvec sixNeighbors[]={hvec(1,0),hvec(1,1),hvec(0,1),hvec(-1,0),hvec(-1,-1),hvec(0,-1)};
+
+hvec roundframe(sixvec s)
+/* Finds the frame whose torus point is closest to s. Each pair of
+ * components of s gives the imaginary part of z, zω, or zω², modulo the
+ * period, by atan2; any two of them give z. Starting from the frame nearest
+ * each of the three estimates, it steps to a closer neighbor until there
+ * is none.
+ *
+ * A sum of weak or inconsistent frames can have more than one local
+ * minimum, so the distance found then bounds how far each angle of a closer
+ * frame can be from that of s, which bounds how far it can be from the
+ * estimate, and all frames that near are tried. Ties go to the lower index,
+ * as in roundframeBrute, whose result it matches.
+ */
+{
+  const vector<sixvec> &table=frameSixvecs();
+  int i,n,inx,bestinx=-1,nextinx,rad,minrad=FRAMERAD,mini=0;
+  double norm,distance,mindist=10,here,d2,c,dx,dy;
+  double im[3],r[3],span[3];
+  complex<double> z;
+  hvec h,q,next,best,seed[3];
+  norm=s.norm();
+  assert(norm>0);
+  s/=(norm/M_SQRT_3);
+  for (i=0;i<3;i++)
+  {
+    im[i]=atan2(s.v[2*i+1],s.v[2*i])*M_SQRT_3_4/(2*M_PI);
+    r[i]=hypot(s.v[2*i],s.v[2*i+1]);
+  }
+  for (i=0;i<3;i++)
+  {
+    /* Im(w)=im[i] and Im(wω)=im[i+1], where w=zω^i. Im(wω)=Re(w)√3/2-Im(w)/2,
+     * so Re(w)=(im[i+1]+im[i]/2)/(√3/2).
+     */
+    z=complex<double>((im[(i+1)%3]+im[i]/2)/M_SQRT_3_4,im[i]);
+    for (n=0;n<i;n++)
+      z*=omega*omega;
+    hdivmod<FrameMod>(hvec(z*(complex<double>)FRAMEMOD),q,h);
+    seed[i]=h;
+    inx=h.pageinx(FRAMERAD,FRAMESIZE);
+    here=(s-table[inx]).norm();
+    do
     {
-      il=0;
-      frame=ninedisp[n]-(complex<double>)twelve[t];
+      best=h;
+      for (n=0;n<6;n++)
+      {
+	hdivmod<FrameMod>(best+sixNeighbors[n],q,next);
+	nextinx=next.pageinx(FRAMERAD,FRAMESIZE);
+	distance=(s-table[nextinx]).norm();
+	if (distance<here || (distance==here && nextinx<inx))
+	{
+	  here=distance;
+	  inx=nextinx;
+	  h=next;
+	}
+      }
+    } while (h!=best);
+    if (here<mindist || (here==mindist && inx<bestinx))
+    {
+      mindist=here;
+      bestinx=inx;
+    }
+  }
+  /* A frame p no farther than mindist has, for each k,
+   * r[k]²+1-2r[k]cos(angle) <= mindist²-sum over j!=k of (r[j]-1)².
+   * span is the resulting bound on the difference of imaginary parts.
+   */
+  d2=mindist*mindist*(1+1e-9)+1e-12;
+  for (i=0;i<3;i++)
+  {
+    c=r[i]*r[i]+1-d2;
+    for (n=0;n<3;n++)
+      if (n!=i)
+	c+=(r[n]-1)*(r[n]-1);
+    c=(r[i]>0)?c/(2*r[i]):-1;
+    span[i]=(c>-1)?acos(min(c,1.))*M_SQRT_3_4/(2*M_PI):M_SQRT_3_4/2;
+  }
+  for (i=0;i<3;i++)
+  {
+    dy=span[i];
+    dx=(span[(i+1)%3]+span[i]/2)/M_SQRT_3_4;
+    // hex radius, in frames, of the parallelogram, plus rounding of the seed
+    rad=ceil(hypot(dx,dy)*abs((complex<double>)FRAMEMOD)*2/M_SQRT_3)+1;
+    if (rad<minrad)
+    {
+      minrad=rad;
+      mini=i;
+    }
+  }
+  if (minrad<FRAMERAD)
+    for (h=start(minrad);h.cont(minrad);h.inc(minrad))
+    {
+      hdivmod<FrameMod>(seed[mini]+h,q,next);
+      nextinx=next.pageinx(FRAMERAD,FRAMESIZE);
+      distance=(s-table[nextinx]).norm();
+      if (distance<mindist || (distance==mindist && nextinx<bestinx))
+      {
+	mindist=distance;
+	bestinx=nextinx;
+      }
+    }
+  else
+    for (nextinx=0;nextinx<FRAMESIZE;nextinx++)
+    {
+      distance=(s-table[nextinx]).norm();
+      if (distance<mindist || (distance==mindist && nextinx<bestinx))
+      {
+	mindist=distance;
+	bestinx=nextinx;
+      }
+    }
+  return nthhvec(bestinx,FRAMERAD,FRAMESIZE);
+}
+
+struct FrameGeometry
+/* What shiftFrame reads for each of the 12 framings of each of the 9
+ * displacements. Each of the 12 bits of a framing is read, like filletbit,
+ * from its region and the 7 bits around it. Every bit of the canvas belongs
+ * to one of the 19 letters drawn around the origin, or to none, so each of
+ * the 7 is stored as letter slot*12+bit, or FRAMECELLS for none, which is 0.
+ * It depends only on ninedisp, twelve, weights, and the regions.
+ */
+{
+  vector<short> cells; // [9][12][12][7]
+  vector<char> regions; // [9][12][12]
+  vector<sixvec> torus; // [9][12], weighted
+};
+
+#define FRAMECELLS (19*12)
+
+const FrameGeometry &frameGeometry()
+{
+  static const FrameGeometry geom=[]()
+  {
+    FrameGeometry ret;
+    int m,n,t,slot;
+    complex<double> frame,point;
+    double x[9*12*12],y[9*12*12];
+    locreg samples[9*12*12];
+    map<hvec,int> owner;
+    map<hvec,int>::iterator it;
+    hvec disp,k;
+    for (disp=start(2),slot=0;disp.cont(2);disp.inc(2),slot++)
       for (m=0;m<12;m++)
-	il|=filletbit((complex<double>)twelve[m]+frame,hbits)<<m;
-      ret.torus[il]+=sixvec(frame/ZLETTERMOD)*weights[n];
-      ret.suminv+=invar12(il)*weights[n];
+	owner[disp*LETTERMOD+twelve[m]]=slot*12+m;
+    for (n=0;n<9;n++)
+      for (t=0;t<12;t++)
+      {
+	frame=ninedisp[n]-(complex<double>)twelve[t];
+	ret.torus.push_back(sixvec(frame/ZLETTERMOD)*weights[n]);
+	for (m=0;m<12;m++)
+	{
+	  point=(complex<double>)twelve[m]+frame;
+	  x[(n*12+t)*12+m]=point.real();
+	  y[(n*12+t)*12+m]=point.imag();
+	}
+      }
+    locregions(x,y,9*12*12,samples);
+    for (n=0;n<9*12*12;n++)
+    {
+      ret.regions.push_back(samples[n].region);
+      for (k=start(1);k.cont(1);k.inc(1))
+      {
+	it=owner.find(samples[n].location+k);
+	ret.cells.push_back((it==owner.end())?FRAMECELLS:it->second);
+      }
     }
+    return ret;
+  }();
+  return geom;
+}
+
+void frameBits(const char *cell,int *bits)
+/* Reads all 1296 bits of the framings from the bits of the 19 letters,
+ * as numbered in FrameGeometry. cell[FRAMECELLS] must be 0.
+ */
+{
+  const FrameGeometry &geom=frameGeometry();
+  const short *nb=geom.cells.data();
+  int n,k,index;
+  for (n=0;n<9*12*12;n++,nb+=7)
+  {
+    for (k=index=0;k<7;k++)
+      index=(index<<1)|cell[nb[k]];
+    bits[n]=(regbits[(int)geom.regions[n]][index>>5]>>(index&31))&1;
+  }
+}
+
+InvLetterResult shiftFrame(const harray<char> &hletters,int i,int j,int k,int l)
+{
+  const FrameGeometry &geom=frameGeometry();
+  int m,n,il,slot,pattern;
+  hvec disp;
+  char cell[FRAMECELLS+1];
+  int bits[9*12*12];
+  InvLetterResult ret;
+  ret.suminv=0;
+  for (disp=start(2),slot=0;disp.cont(2);disp.inc(2),slot++)
+  {
+    pattern=letters[(int)hletters.get(disp)];
+    for (m=0;m<12;m++)
+      cell[slot*12+m]=(pattern>>m)&1;
+  }
+  cell[FRAMECELLS]=0;
+  frameBits(cell,bits);
+  for (n=0;n<9*12;n++)
+  {
+    for (m=il=0;m<12;m++)
+      il|=bits[n*12+m]<<m;
+    ret.torus[il]+=geom.torus[n];
+    ret.suminv+=invar12(il)*weights[n/12];
+  }
   ret.i=i;
   ret.j=j;
   ret.k=k;
@@ -372,46 +569,18 @@ InvLetterResult shiftFrame(harray<char> hletters,int i,int j,int k,int l)
 
 void fillinvletters()
 {
-  int i,j,k,l,m,n,t,inv[4096],il,in,stats[6],watch=0x0e2;
-  int done=0;
-  map<int,sixvec>::iterator it;
-  int suminvar[32][32][32][32];
-  sixvec torussum[4096],watchlast;
-  hvec disp;
-  InvLetterTask task;
-  InvLetterResult result;
+  int i,j,k,l,stats[6],watch=0x0e2;
+  int done=0,computed=0;
+  vector<int> suminvar(1048576); // [32][32][32][32], too big for the stack
+  vector<sixvec> torussum(4096);
+  map<int,map<int,sixvec> > pending;
+  mutex reduceMutex;
+  chrono::steady_clock::time_point nextProgress=clk.now();
   fstream outfile;
-  memset(inv,0,sizeof(inv));
-  memset(suminvar,0,sizeof(suminvar));
-  /* Fill the inverse letter table with all patterns that are
-   * either letters or one bit different from letters.
+  /* Start with all patterns that are either letters or one bit different
+   * from letters.
    */
-  for (i=0;i<32;i++)
-  {
-    inv[letters[i]]=i+32;
-    for (j=0;j<12;j++)
-    {
-      il=letters[i]^(1<<j);
-      in=i+64;
-      while (in&inv[il])
-        in<<=8;
-      inv[il]|=in;
-    }
-  }
-  invletters.resize(4096);
-  for (i=0;i<4096;i++)
-  {
-    if (inv[i]&0x400000)
-      invletters[i]=((inv[i]&0x1f0000)>>6)|((inv[i]&0x1f00)>>3)|(inv[i]&0x1f)|0x8000;
-    else if (inv[i]&0x4000)
-      invletters[i]=((inv[i]&0x1f00)>>3)|(inv[i]&0x1f)|0x4000;
-    else if (inv[i]&0x40)
-      invletters[i]=(inv[i]&0x1f)|0x2000;
-    else if (inv[i]&0x20)
-      invletters[i]=(inv[i]&0x1f)|0x1000;
-    else
-      invletters[i]=0;
-  }
+  invletters=LetterSet().inverse;
   /* Find all possible reads caused by framing errors. Fill a size-2 array
    * with four letters as follows:
    *         k k         l l
@@ -511,52 +680,66 @@ void fillinvletters()
    * o * * o (0x130) has a torussum of nearly zero and is counted as not found.
    *  o o o
    */
-  for (i=0;i<32;i++)
+  /* Each (i,j) pair is a chunk of 1024 framings, summed by whichever thread
+   * takes it into its own torussum. Finished chunks are added to the total
+   * in chunk order, so the table does not depend on the number of threads.
+   *
+   * Complementing all four letters complements every pattern read and
+   * leaves the frames alone, so only chunks with i<16 are read. The chunk
+   * of the complements, (31-i,31-j), is the same results with patterns
+   * complemented, summed in reverse order, which is the order in which that
+   * chunk would have read them, so the sums are bit for bit the same. No
+   * other symmetry holds exactly: the nine displacements are not symmetric
+   * under rotation, and no permutation of i, j, k, and l gives the same
+   * patterns.
+   */
+  parallelFor(512,[&](int chunk)
   {
-    hletters[0]=i;
-    for (j=0;j<32;j++)
+    int i=chunk>>5,j=chunk&31,k,l,n;
+    harray<char> chunkletters;
+    vector<InvLetterResult> results;
+    map<int,sixvec> chunksum,complementsum;
+    map<int,sixvec>::iterator it;
+    chunkletters[0]=i;
+    chunkletters[hvec(1,2)]=chunkletters[hvec(-1,-2)]=chunkletters[1]=chunkletters[-1]=j;
+    for (k=0;k<32;k++)
     {
-      hletters[hvec(1,2)]=hletters[hvec(-1,-2)]=hletters[1]=hletters[-1]=j;
-      printf("%c%c",i+'@',j+'@');
-      fflush(stdout);
-      for (k=0;k<32;k++)
+      chunkletters[hvec(2,1)]=chunkletters[hvec(-2,-1)]=chunkletters[hvec(0,1)]=chunkletters[hvec(0,-1)]=k;
+      for (l=0;l<32;l++)
       {
-        hletters[hvec(2,1)]=hletters[hvec(-2,-1)]=hletters[hvec(0,1)]=hletters[hvec(0,-1)]=k;
-        for (l=0;l<32;l++)
-	{
-	  hletters[hvec(1,-1)]=hletters[hvec(-1,1)]=hletters[hvec(1,1)]=hletters[hvec(-1,-1)]=l;
-	  task.hletters=hletters;
-	  task.i=i;
-	  task.j=j;
-	  task.k=k;
-	  task.l=l;
-	  n=taskQueueSize();
-	  this_thread::sleep_for(chrono::microseconds(n*n));
-	  enqueueInvLetterTask(task);
-	  for (n=0;n<2 || ((i&j&k&l)==31 && done<1048576);n++)
-	  {
-	    result=dequeueInvLetterResult();
-	    if (result.i>=0)
-	    {
-	      ++done;
-	      for (it=result.torus.begin();it!=result.torus.end();++it)
-		torussum[it->first]+=it->second;
-	      suminvar[result.i][result.j][result.k][result.l]+=result.suminv;
-	    }
-	  }
-	  if (watchlast!=torussum[watch])
-	  {
-	    printf("%c%c ",k+'@',l+'@');
-	    for (n=0;n<6;n++)
-	      printf("%.0f ",torussum[watch].v[n]);
-	    printf("\n%c%c",i+'@',j+'@');
-	    watchlast=torussum[watch];
-	  }
-	}
+	chunkletters[hvec(1,-1)]=chunkletters[hvec(-1,1)]=chunkletters[hvec(1,1)]=chunkletters[hvec(-1,-1)]=l;
+	results.push_back(shiftFrame(chunkletters,i,j,k,l));
+	for (it=results.back().torus.begin();it!=results.back().torus.end();++it)
+	  chunksum[it->first]+=it->second;
+	// invar12 is invariant under complementing.
+	suminvar[((i*32+j)*32+k)*32+l]=suminvar[(((31-i)*32+31-j)*32+31-k)*32+31-l]=results.back().suminv;
       }
-      printf("\b\b");
     }
-  }
+    for (n=1023;n>=0;n--)
+      for (it=results[n].torus.begin();it!=results[n].torus.end();++it)
+	complementsum[4095-it->first]+=it->second;
+    reduceMutex.lock();
+    pending[chunk].swap(chunksum);
+    pending[1023-chunk].swap(complementsum);
+    while (pending.size() && pending.begin()->first==done)
+    {
+      for (it=pending.begin()->second.begin();it!=pending.begin()->second.end();++it)
+	torussum[it->first]+=it->second;
+      pending.erase(pending.begin());
+      done++;
+    }
+    computed++;
+    if (clk.now()>nextProgress || computed==512)
+    {
+      printf("\r%c%c %3d/512 ",i+'@',j+'@',computed);
+      for (n=0;n<6;n++)
+	printf("%.0f ",torussum[watch].v[n]);
+      fflush(stdout);
+      nextProgress=clk.now()+chrono::seconds(1);
+    }
+    reduceMutex.unlock();
+  });
+  printf("\n");
   memset(stats,0,sizeof(stats));
   for (i=0;i<4096;i++)
   {
@@ -626,7 +809,7 @@ void fillinvletters()
   outfile.open("torussum.dat",ios_base::out|ios_base::binary);
   if (outfile.is_open())
   {
-    outfile.write((char *)torussum,sizeof(torussum));
+    outfile.write((char *)&torussum[0],torussum.size()*sizeof(torussum[0]));
     outfile.close();
   }
   for (i=0;i<0;i++)
@@ -634,9 +817,9 @@ void fillinvletters()
       for (k=0;k<32;k++)
 	for (l=0;l<32;l++)
 	{
-	  if (suminvar[i][j][k][l]!=suminvar[31-i][31-j][31-k][31-l])
+	  if (suminvar[((i*32+j)*32+k)*32+l]!=suminvar[(((31-i)*32+31-j)*32+31-k)*32+31-l])
 	    printf("%c%c%c%c 2  ",i+'@',j+'@',k+'@',l+'@');
-	  if (suminvar[i][j][k][l]!=suminvar[rotateletter[i]][rotateletter[l]][rotateletter[j]][rotateletter[k]])
+	  if (suminvar[((i*32+j)*32+k)*32+l]!=suminvar[((rotateletter[i]*32+rotateletter[l])*32+rotateletter[j])*32+rotateletter[k]])
 	    printf("%c%c%c%c 3  ",i+'@',j+'@',k+'@',l+'@');
 	}
   printf("%4d are exactly a letter\n",stats[0]);
@@ -647,8 +830,60 @@ void fillinvletters()
   printf("%4d don't match anything\n",stats[5]);
 }
 
+uint64_t hashInvletters(const uint16_t *table)
+// FNV-1a of the 4096 words, so that a table is validated only once.
+{
+  uint64_t h=0xcbf29ce484222325;
+  int i;
+  for (i=0;i<4096;i++)
+    h=(h^table[i])*0x100000001b3;
+  return h;
+}
+
+bool mapinvletters(string filename)
+/* Reads invletters.dat from the share directory. The table is only 8 KiB,
+ * so it is copied out of the mapping rather than kept mapped.
+ */
+{
+  bool ret=false;
+#ifdef HAVE_SYS_MMAN_H
+  int fd;
+  struct stat st;
+  void *map;
+  fd=open(filename.c_str(),O_RDONLY);
+  if (fd>=0)
+  {
+    if (fstat(fd,&st)==0 && st.st_size==4096*sizeof(invletters[0]))
+    {
+      map=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+      if (map!=MAP_FAILED)
+      {
+	invletters.resize(4096);
+	memcpy(&invletters[0],map,st.st_size);
+	munmap(map,st.st_size);
+	ret=true;
+      }
+    }
+    close(fd);
+  }
+#else
+  fstream infile;
+  infile.open(filename,ios_base::in|ios_base::binary);
+  if (infile.is_open())
+  {
+    invletters.resize(4096);
+    infile.read((char *)&invletters[0],4096*sizeof(invletters[0]));
+    ret=infile.gcount()==4096*sizeof(invletters[0]);
+    infile.close();
+  }
+#endif
+  return ret;
+}
+
 void readinvletters()
-//TODO: search in /usr/share, or $PREFIX/share
+/* A table written by --writetables in the current directory overrides
+ * the installed one, which overrides the one compiled in.
+ */
 {
   fstream infile;
   infile.open("invletters.dat",ios_base::in|ios_base::binary);
@@ -658,6 +893,8 @@ void readinvletters()
     infile.read((char *)&invletters[0],4096*sizeof(invletters[0]));
     infile.close();
   }
+  else if (!mapinvletters(string(SHARE_DIR)+"/invletters.dat"))
+    invletters.assign(builtinInvletters,builtinInvletters+4096);
 }
 
 void debugframingerror()
@@ -665,7 +902,7 @@ void debugframingerror()
   int i,j,k,l,m,n,t,r,c,ch,il,in,stats[6],readings0[9][12],readings1[9][12];
   bool flip=false; // either flip all the bits, or rotate 120°
   bool err=false;
-  hvec disp,a,rem;
+  hvec disp,a,q,rem;
   complex<double> frame;
   i=16;
   j=1;
@@ -677,7 +914,7 @@ void debugframingerror()
   hletters[hvec(2,1)]=hletters[hvec(-2,-1)]=hletters[hvec(0,1)]=hletters[hvec(0,-1)]=k;
   hletters[hvec(1,-1)]=hletters[hvec(-1,1)]=hletters[hvec(1,1)]=hletters[hvec(-1,-1)]=l;
   for (disp=start(2);disp.cont(2);disp.inc(2))
-    drawletter(hletters[disp],disp);
+    drawletter(hletters.get(disp),disp);
   for (n=0;n<9;n++)
     for (t=0;t<12;t++)
     {
@@ -693,7 +930,7 @@ void debugframingerror()
       if ((c+r)&1)
       {
 	a=hvec((c-r-1)/2,-r);
-	rem=a%LETTERMOD;
+	hdivmod<LetterMod>(a,q,rem);
 	ch=i?j?' ':'|':'-';
 	switch (rem.letterinx())
 	{
@@ -715,7 +952,7 @@ void debugframingerror()
       else
       {
 	a=hvec((c-r)/2,-r);
-	ch=(hbits[a]&1)*10+32;
+	ch=(hbits.get(a)&1)*10+32;
 	putchar(ch);
       }
     for (c=0;c<9;c++)
@@ -738,7 +975,7 @@ void debugframingerror()
     hletters[hvec(1,-1)]=hletters[hvec(-1,1)]=hletters[hvec(1,1)]=hletters[hvec(-1,-1)]=rotateletter[k];
   }
   for (disp=start(2);disp.cont(2);disp.inc(2))
-    drawletter(hletters[disp],disp);
+    drawletter(hletters.get(disp),disp);
   for (n=0;n<9;n++)
     for (t=0;t<12;t++)
     {
@@ -754,7 +991,7 @@ void debugframingerror()
       if ((c+r)&1)
       {
 	a=hvec((c-r-1)/2,-r);
-	rem=a%LETTERMOD;
+	hdivmod<LetterMod>(a,q,rem);
 	ch=i?j?' ':'|':'-';
 	switch (rem.letterinx())
 	{
@@ -776,7 +1013,7 @@ void debugframingerror()
       else
       {
 	a=hvec((c-r)/2,-r);
-	ch=(hbits[a]&1)*10+32;
+	ch=(hbits.get(a)&1)*10+32;
 	putchar(ch);
       }
     for (c=0;c<9;c++)
@@ -802,10 +1039,21 @@ void writeinvletters()
 }
 
 void checkinvletters()
+/* validHash is the hash of the last table found valid, so that checking
+ * the same table again is only a hash. It's atomic, since decoders in
+ * several threads may check at once; two that race both do the full check.
+ */
 {
+  static atomic<uint64_t> validHash(0);
   int i,j,r,countframingerrors,sumLetters,xorBits=0;
-  hvec g,h;
+  hvec g,h,q,rem;
   bool valid=true;
+  uint64_t hash;
+  if (invletters.size()!=4096)
+    throw(runtime_error("invletters.dat is missing or corrupt. Run \"propolis --writetables\" to create it."));
+  hash=hashInvletters(&invletters[0]);
+  if (hash==validHash)
+    return;
   for (i=0;i<32;i++)
     if (invletters[letters[i]]!=(i|0x1000))
       valid=false;
@@ -839,7 +1087,8 @@ void checkinvletters()
       if ((invletters[r]&0xf000)==0x6000 && (invletters[r]-0x6000)<FRAMESIZE)
       {
         g=nthhvec(invletters[r]-0x6000,FRAMERAD,FRAMESIZE);
-        if (((g-h*omega)%FRAMEMOD).norm()>1)
+        hdivmod<FrameMod>(g-h*omega,q,rem);
+        if (rem.norm()>1)
 	{
 	  valid=false;
 	  if (debugletters)
@@ -861,7 +1110,8 @@ void checkinvletters()
       if ((invletters[r]&0xf000)==0x6000 && (invletters[r]-0x6000)<FRAMESIZE)
       {
         g=nthhvec(invletters[r]-0x6000,FRAMERAD,FRAMESIZE);
-        if (((g-h)%FRAMEMOD).norm()>1)
+        hdivmod<FrameMod>(g-h,q,rem);
+        if (rem.norm()>1)
 	{
 	  valid=false;
 	  if (debugletters)
@@ -885,10 +1135,31 @@ void checkinvletters()
     valid=false;
   if (!valid)
     throw(runtime_error("invletters.dat is missing or corrupt. Run \"propolis --writetables\" to create it."));
+  validHash=hash;
+}
+
+sixvec randomFrameSum(int i)
+/* A sum of a few frames, with random weights, as in the table, or, if i%3
+ * is 2, a random vector.
+ */
+{
+  int j;
+  sixvec s,t;
+  if (i%3==2)
+    for (j=0;j<6;j++)
+      s.v[j]=rand()%2001-1000;
+  else
+    for (j=0;j<=i%5;j++)
+    {
+      t=frameSixvecs()[rand()%FRAMESIZE];
+      s+=t*(rand()%1000+1);
+    }
+  return s;
 }
 
 void testroundframe()
 {
+  int i,errors;
   hvec h;
   sixvec s,t;
   s=sixvec(complex<double>(0.25,0.2));
@@ -900,6 +1171,35 @@ void testroundframe()
   s+=t;
   h=roundframe(s);
   printf("Average  : %d,%d\n",h.getx(),h.gety());
+  // Compare with roundframeBrute.
+  for (i=errors=0;i<3000;i++)
+  {
+    s=randomFrameSum(i);
+    if (s.norm()>0 && roundframe(s)!=roundframeBrute(s))
+      errors++;
+  }
+  cout<<"roundframe: "<<errors<<" differ from brute force"<<endl;
+  tassert(errors==0);
+}
+
+void benchroundframe()
+// Times roundframe and roundframeBrute on the same 3000 vectors.
+{
+  int i;
+  vector<sixvec> s;
+  vector<hvec> h(3000);
+  chrono::steady_clock::time_point t0,t1,t2;
+  for (i=0;i<3000;i++)
+    s.push_back(randomFrameSum(i));
+  t0=clk.now();
+  for (i=0;i<3000;i++)
+    h[i]=roundframe(s[i]);
+  t1=clk.now();
+  for (i=0;i<3000;i++)
+    h[i]=roundframeBrute(s[i]);
+  t2=clk.now();
+  cout<<"roundframe: "<<chrono::duration<double,micro>(t1-t0).count()/3000
+      <<" µs vs "<<chrono::duration<double,micro>(t2-t1).count()/3000<<" µs brute force"<<endl;
 }
 
 void testrotate()
@@ -942,8 +1242,7 @@ void litteron::setprob(array<signed char,12> seen,int index)
 {
   int i,j;
   float probf[32],maxprob=0,minprob=INFINITY,medprob;
-  if (!exp252tab.size())
-    initexp252tab();
+  call_once(exp252once,initexp252tab);
   for (i=0;i<32;i++)
   {
     for (j=0,probf[i]=1;j<12;j++)
@@ -955,7 +1254,7 @@ void litteron::setprob(array<signed char,12> seen,int index)
   }
   medprob=sqrtf(maxprob*minprob);
   for (i=0;i<32;i++)
-    letterprob[i]=21*log2f(probf[i]/medprob);
+    letterprob[i]=(int)(21*log2f(probf[i]/medprob)); // negative float to unsigned char is undefined
 }
 
 void litteron::setprob(short seen,int index)
@@ -972,6 +1271,7 @@ void litteron::propagate(array<signed char,5> belief)
   float bittmp[5]={0,0,0,0,0};
   float thisprob,maxprob=0;
   int i,j;
+  call_once(exp252once,initexp252tab);
   for (i=0;i<32;i++)
   {
     for (thisprob=1,j=0;j<5;j++)
@@ -992,6 +1292,131 @@ signed char litteron::operator[](int n)
   return softbits[n];
 }
 
+LitteronBank::LitteronBank(int size)
+{
+  resize(size);
+}
+
+void LitteronBank::resize(int size)
+{
+  n=size;
+  letterprob.assign(32*n,0);
+  softbits.assign(5*n,0);
+  work.resize(32*n);
+}
+
+#if defined(__SSE2__)
+static inline __m128 softfactor(const signed char *p,int sign,int offset)
+// Four of p[k]*sign+offset as floats. sign is 1 or -1.
+{
+  __m128i v;
+  int four;
+  memcpy(&four,p,4);
+  v=_mm_cvtsi32_si128(four);
+  v=_mm_srai_epi16(_mm_unpacklo_epi8(v,v),8);
+  v=_mm_srai_epi32(_mm_unpacklo_epi16(v,v),16);
+  if (sign<0)
+    v=_mm_sub_epi32(_mm_setzero_si128(),v);
+  return _mm_cvtepi32_ps(_mm_add_epi32(v,_mm_set1_epi32(offset)));
+}
+#endif
+
+void LitteronBank::setprob(const signed char *seen)
+/* Does the same float operations, in the same order, as litteron::setprob,
+ * four letters at a time, so the results are identical.
+ */
+{
+  int i,j,k,sign;
+  float *probf;
+  vector<float> maxprob(n,0),minprob(n,INFINITY);
+  float medprob;
+  call_once(exp252once,initexp252tab);
+  for (i=0;i<32;i++)
+  {
+    probf=&work[i*n];
+    for (k=0;k<n;k++)
+      probf[k]=1;
+    for (j=0;j<12;j++)
+    {
+      sign=1-((letters[i]>>j)&1)*2;
+      k=0;
+#if defined(__SSE2__)
+      for (;k+4<=n;k+=4)
+	_mm_storeu_ps(probf+k,_mm_mul_ps(_mm_loadu_ps(probf+k),softfactor(seen+j*n+k,sign,254)));
+#endif
+      for (;k<n;k++)
+	probf[k]*=seen[j*n+k]*sign+254;
+    }
+    for (k=0;k<n;k++)
+    {
+      if (probf[k]>maxprob[k])
+	maxprob[k]=probf[k];
+      if (probf[k]<minprob[k])
+	minprob[k]=probf[k];
+    }
+  }
+  for (k=0;k<n;k++)
+  {
+    medprob=sqrtf(maxprob[k]*minprob[k]);
+    for (i=0;i<32;i++)
+      letterprob[i*n+k]=(int)(21*log2f(work[i*n+k]/medprob));
+  }
+}
+
+void LitteronBank::setprob(const short *seen)
+{
+  vector<signed char> seena(12*n);
+  int i,k;
+  for (i=0;i<12;i++)
+    for (k=0;k<n;k++)
+      seena[i*n+k]=((seen[k]>>i)&1)?-127:127;
+  setprob(seena.data());
+}
+
+void LitteronBank::propagate(const signed char *belief)
+// As litteron::propagate, for all n letters. belief is [5][n].
+{
+  float *bittmp=work.data(); // [5][n]
+  float thisprob[4],expprob[4],maxprob;
+  int i,j,k,m,sign;
+  call_once(exp252once,initexp252tab);
+  for (k=0;k<5*n;k++)
+    bittmp[k]=0;
+  k=0;
+#if defined(__SSE2__)
+  __m128 thisv,prod;
+  for (;k+4<=n;k+=4)
+    for (i=0;i<32;i++)
+    {
+      thisv=_mm_set1_ps(1);
+      for (j=0;j<5;j++)
+	thisv=_mm_mul_ps(thisv,softfactor(belief+j*n+k,1-((i>>j)&1)*2,127));
+      for (m=0;m<4;m++)
+	expprob[m]=exp252tab[letterprob[i*n+k+m]];
+      prod=_mm_mul_ps(thisv,_mm_loadu_ps(expprob));
+      for (j=0;j<5;j++)
+	_mm_storeu_ps(bittmp+j*n+k,_mm_add_ps(_mm_loadu_ps(bittmp+j*n+k),
+	  _mm_mul_ps(prod,_mm_set1_ps(1-((i>>j)&1)*2))));
+    }
+#endif
+  for (;k<n;k++)
+    for (i=0;i<32;i++)
+    {
+      for (thisprob[0]=1,j=0;j<5;j++)
+	thisprob[0]*=belief[j*n+k]*(1-((i>>j)&1)*2)+127;
+      for (j=0;j<5;j++)
+	bittmp[j*n+k]+=thisprob[0]*exp252tab[letterprob[i*n+k]]*(1-((i>>j)&1)*2);
+    }
+  for (k=0;k<n;k++)
+  {
+    for (maxprob=j=0;j<5;j++)
+      if (maxprob<bittmp[j*n+k])
+	maxprob=bittmp[j*n+k];
+    for (j=0;j<5;j++)
+      softbits[j*n+k]=rintf(bittmp[j*n+k]/maxprob*127.375);
+  }
+}
+
 /* Find the best letter assignment for belief propagation. The original
  * assignment had D differing by only two bits from @, so if a Hamming code
  * in bit 2 is uncertain between D/@ or [/_, the other bits can't help decide.
@@ -1086,15 +1511,24 @@ int twist5(int letter,int n)
 
 uint16_t abdhp[]={0x007,0xf80,0xc00,0xa64,0x499};
 
-void fillLetters(int perm,int negs,int splay,int twist)
-/* Fills letters with one of 7680 assignments:
+LetterSet::LetterSet()
+{
+  copy(letters,letters+38,patterns.begin());
+  copy(rotateletter,rotateletter+32,rotation.begin());
+  fillTables();
+}
+
+LetterSet::LetterSet(int perm,int negs,int splay,int twist)
+/* Makes one of 7680 assignments:
  * perm (0-23) permutes the single-bit letters (A,B,D,H,P) and their complements;
  * negs (0-31) exchanges A/^, B/], D/[, H/W, or P/O;
  * splay (0-1) rotates D left to I and right to Q or vice versa;
  * twist (0-4) rotates each five-bit letter by a multiple of its bit count.
+ * @, _, and the border letters are the same in all of them.
  */
 {
   int i,j,let,bits;
+  copy(letters,letters+38,patterns.begin());
   for (i=0;i<5;i++)
     for (j=0;j<3;j++)
     {
@@ -1108,16 +1542,68 @@ void fillLetters(int perm,int negs,int splay,int twist)
 	bits=rotate(bits);
       if (j==1)
 	bits=rotate(bits);
-      letters[twist5(let,twist)]=bits;
-      letters[twist5(let^31,twist)]=bits^0xfff;
+      patterns[twist5(let,twist)]=bits;
+      patterns[twist5(let^31,twist)]=bits^0xfff;
     }
   for (i=0;i<32;i++)
     for (j=0;j<32;j++)
-      if (letters[i]==rotate(letters[j]))
-	rotateletter[j]=i;
+      if (patterns[i]==rotate(patterns[j]))
+	rotation[j]=i;
+  fillTables();
+}
+
+void LetterSet::fillTables()
+// Fills inverse with all patterns that are letters or one bit different from letters.
+{
+  int i,j,il,in,inv[4096];
+  memset(inv,0,sizeof(inv));
+  for (i=0;i<32;i++)
+  {
+    inv[patterns[i]]=i+32;
+    for (j=0;j<12;j++)
+    {
+      il=patterns[i]^(1<<j);
+      in=i+64;
+      while (in&inv[il])
+        in<<=8;
+      inv[il]|=in;
+    }
+  }
+  inverse.resize(4096);
+  for (i=0;i<4096;i++)
+  {
+    if (inv[i]&0x400000)
+      inverse[i]=((inv[i]&0x1f0000)>>6)|((inv[i]&0x1f00)>>3)|(inv[i]&0x1f)|0x8000;
+    else if (inv[i]&0x4000)
+      inverse[i]=((inv[i]&0x1f00)>>3)|(inv[i]&0x1f)|0x4000;
+    else if (inv[i]&0x40)
+      inverse[i]=(inv[i]&0x1f)|0x2000;
+    else if (inv[i]&0x20)
+      inverse[i]=(inv[i]&0x1f)|0x1000;
+    else
+      inverse[i]=0;
+  }
+}
+
+void setLetters(const LetterSet &set)
+// Makes set the current letters.
+{
+  copy(set.patterns.begin(),set.patterns.end(),letters);
+  copy(set.rotation.begin(),set.rotation.end(),rotateletter);
 }
 
-int totalBitsDifferent()
+void fillLetters(int perm,int negs,int splay,int twist)
+// Makes one of 7680 assignments, described at LetterSet, the current letters.
+{
+  setLetters(LetterSet(perm,negs,splay,twist));
+}
+
+void drawletter(const LetterSet &set,int letter,hvec place,harray<bool> &canvas)
+{
+  canvas.putLetterBits(place,set.patterns[letter]);
+}
+
+int totalBitsDifferent(const LetterSet &set)
 /* Returns the total number of bits different in pairs of 5-bit letters whose
  * 12-bit patterns differ by 2 bits. The number of bits compared is 420 when
  * 12-bit patterns differing by 2 or 3 bits are checked and 240 when only
@@ -1127,41 +1613,45 @@ int totalBitsDifferent()
   int count=0,i,j;
   for (i=0;i<32;i++)
     for (j=0;j<i;j++)
-      if (bitcount(letters[i]^letters[j])<=2)
+      if (bitcount(set.patterns[i]^set.patterns[j])<=2)
 	count+=bitcount(i^j);
   return count;
 }
 
 void findLetterAssignment()
+/* Tries all 7680 assignments in parallel, then prints, in order, each one
+ * at least as good as all before it, as when they were tried one by one.
+ */
 {
-  int i,perm,negs,splay,twist,count,bestcount=0;
-  for (perm=0;perm<24;perm++)
-    for (negs=0;negs<32;negs++)
-      for (splay=0;splay<2;splay++)
-	for (twist=0;twist<5;twist++)
-	{
-	  fillLetters(perm,negs,splay,twist);
-	  count=totalBitsDifferent();
-	  if (count>=bestcount)
-	  {
-	    printf("%2d%3d%2d%2d%5d ",perm,negs,splay,twist,count);
-	    for (i=0;i<32;i++)
-	      putchar(rotateletter[i]+'@');
-	    putchar('\n');
-	    bestcount=count;
-	  }
-	}
+  int i,n,perm,negs,splay,twist,bestcount=0;
+  vector<int> count(7680);
+  vector<array<char,32> > rotation(7680);
+  parallelFor(7680,[&](int inx)
+  {
+    // inx is ((perm*32+negs)*2+splay)*5+twist
+    LetterSet set(inx/320,(inx/10)%32,(inx/5)%2,inx%5);
+    count[inx]=totalBitsDifferent(set);
+    rotation[inx]=set.rotation;
+  });
+  for (n=0;n<7680;n++)
+    if (count[n]>=bestcount)
+    {
+      perm=n/320;
+      negs=(n/10)%32;
+      splay=(n/5)%2;
+      twist=n%5;
+      printf("%2d%3d%2d%2d%5d ",perm,negs,splay,twist,count[n]);
+      for (i=0;i<32;i++)
+	putchar(rotation[n][i]+'@');
+      putchar('\n');
+      bestcount=count[n];
+    }
 }
 
-Decoding decode(int bits)
+Decoding decodeEntry(int ibits)
+// Decodes an entry of invletters.
 {
   Decoding ret;
-  if (invletters.size()<4096)
-  {
-    readinvletters();
-    checkinvletters();
-  }
-  int ibits=invletters[bits];
   if (ibits&0x8000)
     ret.dtype=off3;
   else
@@ -1186,3 +1676,263 @@ Decoding decode(int bits)
   }
   return ret;
 }
+
+Decoding decode(int bits)
+{
+  if (invletters.size()<4096)
+  {
+    readinvletters();
+    checkinvletters();
+  }
+  return decodeEntry(invletters[bits]);
+}
+
+Decoding decode(int bits,const LetterSet &set)
+/* Decodes bits as read with the letters of set. Patterns that are not
+ * within one bit of a letter are undecodable rather than framing errors,
+ * which are known only for the letters --writetables was run with.
+ */
+{
+  return decodeEntry(set.inverse[bits]);
+}
+
+void decodeGlyphs(const uint16_t *glyphs,int n,GlyphDecodings out)
+/* Decodes n glyphs at once, like decode, but without allocating anything
+ * once the inverse letter table is loaded. The loop has no branches other
+ * than its own, so that the table lookups can be vectorized.
+ */
+{
+  int i,t,type,off3bit;
+  const uint16_t *table;
+  if (invletters.size()<4096)
+  {
+    readinvletters();
+    checkinvletters();
+  }
+  table=invletters.data();
+  for (i=0;i<n;i++)
+  {
+    t=table[glyphs[i]&0xfff];
+    off3bit=t&0x8000;
+    type=off3bit?off3:(t&0xf000);
+    out.dtype[i]=(DecodeType)type;
+    out.letters[i]=t&((off3bit?0x7fff:0)|(type==off2?0x3ff:0)|((type==exact || type==off1)?0x1f:0));
+    out.ferror[i]=(type==framingError)?(t&0xfff):-1;
+  }
+}
+
+void testDecodeGlyphs()
+// Checks decodeGlyphs against decode for every bit pattern.
+{
+  uint16_t glyphs[4096],letters[4096];
+  DecodeType dtype[4096];
+  int16_t ferror[4096];
+  GlyphDecodings out={dtype,letters,ferror};
+  Decoding d;
+  int i,j,errors=0;
+  for (i=0;i<4096;i++)
+    glyphs[i]=i;
+  decodeGlyphs(glyphs,4096,out);
+  for (i=0;i<4096;i++)
+  {
+    d=decode(i);
+    if (d.dtype!=dtype[i])
+      errors++;
+    if (d.dtype==framingError && d.ferror!=nthhvec(ferror[i],FRAMERAD,FRAMESIZE))
+      errors++;
+    if (d.dtype!=framingError && ferror[i]>=0)
+      errors++;
+    for (j=0;j<d.letters.size();j++)
+      if (d.letters[j]!=((letters[i]>>(5*(d.letters.size()-1-j)))&31))
+	errors++;
+    if (letters[i]>>(5*d.letters.size()))
+      errors++;
+  }
+  cout<<"decodeGlyphs: "<<errors<<" errors"<<endl;
+  tassert(errors==0);
+}
+
+void benchDecodeGlyphs()
+// Times decoding 3000 random glyphs.
+{
+  uint16_t glyphs[3000],letters[3000];
+  DecodeType dtype[3000];
+  int16_t ferror[3000];
+  GlyphDecodings out={dtype,letters,ferror};
+  int i;
+  chrono::steady_clock::time_point t0,t1;
+  for (i=0;i<3000;i++)
+    glyphs[i]=rand()&4095;
+  t0=clk.now();
+  decodeGlyphs(glyphs,3000,out);
+  t1=clk.now();
+  cout<<"decodeGlyphs: 3000 glyphs in "<<chrono::duration<double,micro>(t1-t0).count()<<" µs"<<endl;
+}
+
+void testFrameGeometry()
+// Checks the bits read through frameGeometry against filletbit for random letters.
+{
+  harray<char> hl;
+  harray<bool> drawn;
+  hvec disp;
+  int i,n,m,t,slot,errors=0;
+  char cell[FRAMECELLS+1];
+  int bits[9*12*12];
+  complex<double> frame;
+  for (i=0;i<10;i++)
+  {
+    drawn.clear();
+    for (disp=start(2),slot=0;disp.cont(2);disp.inc(2),slot++)
+    {
+      hl[disp]=rand()&31;
+      drawletter(hl[disp],disp,drawn);
+      for (m=0;m<12;m++)
+	cell[slot*12+m]=(letters[(int)hl[disp]]>>m)&1;
+    }
+    cell[FRAMECELLS]=0;
+    frameBits(cell,bits);
+    for (n=0;n<9;n++)
+      for (t=0;t<12;t++)
+      {
+	frame=ninedisp[n]-(complex<double>)twelve[t];
+	for (m=0;m<12;m++)
+	  if (bits[(n*12+t)*12+m]!=filletbit((complex<double>)twelve[m]+frame,drawn))
+	    errors++;
+      }
+  }
+  cout<<"frameGeometry: "<<errors<<" errors"<<endl;
+  tassert(errors==0);
+}
+
+void benchshiftFrame()
+{
+  harray<char> hl;
+  hvec disp;
+  int i;
+  chrono::steady_clock::time_point t0,t1;
+  for (disp=start(2);disp.cont(2);disp.inc(2))
+    hl[disp]=rand()&31;
+  t0=clk.now();
+  for (i=0;i<100;i++)
+    shiftFrame(hl,0,0,0,0);
+  t1=clk.now();
+  cout<<"shiftFrame takes "<<chrono::duration<double,micro>(t1-t0).count()/100<<" µs"<<endl;
+}
+
+void randomLitterons(int n,vector<short> &seen,vector<signed char> &soft,vector<signed char> &belief)
+// Random hard glyphs, soft glyphs, and beliefs for n letters, laid out as LitteronBank takes them.
+{
+  int i;
+  seen.resize(n);
+  soft.resize(12*n);
+  belief.resize(5*n);
+  for (i=0;i<n;i++)
+    seen[i]=rand()&4095;
+  for (i=0;i<12*n;i++)
+    soft[i]=rand()%255-127;
+  for (i=0;i<5*n;i++)
+    belief[i]=rand()%255-127;
+}
+
+void runLitterons(int n,vector<litteron> &single,bool hard,
+		  vector<short> &seen,vector<signed char> &soft,vector<signed char> &belief)
+// Sets each litteron to a hard or soft glyph and propagates its beliefs.
+{
+  int i,j;
+  array<signed char,12> seena;
+  array<signed char,5> beliefa;
+  for (i=0;i<n;i++)
+  {
+    for (j=0;j<5;j++)
+      beliefa[j]=belief[j*n+i];
+    if (hard)
+      single[i].setprob(seen[i],i);
+    else
+    {
+      for (j=0;j<12;j++)
+	seena[j]=soft[j*n+i];
+      single[i].setprob(seena,i);
+    }
+    single[i].propagate(beliefa);
+  }
+}
+
+void testLitteronBank()
+// Checks LitteronBank against litteron for random glyphs and beliefs.
+{
+  int i,j,n=3000,errors=0;
+  vector<litteron> single(n);
+  LitteronBank bank(n);
+  vector<short> seen;
+  vector<signed char> soft,belief;
+  randomLitterons(n,seen,soft,belief);
+  runLitterons(n,single,true,seen,soft,belief);
+  bank.setprob(seen.data());
+  bank.propagate(belief.data());
+  for (i=0;i<n;i++)
+    for (j=0;j<5;j++)
+      if (single[i][j]!=bank.get(i,j))
+	errors++;
+  runLitterons(n,single,false,seen,soft,belief);
+  bank.setprob(soft.data());
+  bank.propagate(belief.data());
+  for (i=0;i<n;i++)
+    for (j=0;j<5;j++)
+      if (single[i][j]!=bank.get(i,j))
+	errors++;
+  cout<<"LitteronBank: "<<errors<<" errors"<<endl;
+  tassert(errors==0);
+}
+
+void benchLitteronBank()
+// Times LitteronBank and litteron on 3000 hard and 3000 soft letters.
+{
+  int n=3000;
+  vector<litteron> single(n);
+  LitteronBank bank(n);
+  vector<short> seen;
+  vector<signed char> soft,belief;
+  chrono::steady_clock::time_point t0,t1,t2;
+  randomLitterons(n,seen,soft,belief);
+  t0=clk.now();
+  runLitterons(n,single,true,seen,soft,belief);
+  runLitterons(n,single,false,seen,soft,belief);
+  t1=clk.now();
+  bank.setprob(seen.data());
+  bank.propagate(belief.data());
+  bank.setprob(soft.data());
+  bank.propagate(belief.data());
+  t2=clk.now();
+  cout<<"LitteronBank: "<<chrono::duration<double,milli>(t2-t1).count()<<" ms vs "
+      <<chrono::duration<double,milli>(t1-t0).count()<<" ms for litteron"<<endl;
+}
+
+void testLetterSet()
+/* Checks that LetterSet makes the same letters as fillLetters and decodes
+ * like decode, then restores the letters.
+ */
+{
+  int i,n,errors=0;
+  LetterSet set;
+  Decoding d0,d1;
+  for (i=0;i<4096;i++)
+  {
+    d0=decode(i);
+    d1=decode(i,set);
+    if (d0.dtype!=framingError && (d0.dtype!=d1.dtype || d0.letters!=d1.letters))
+      errors++;
+  }
+  for (n=0;n<7680;n+=97)
+  {
+    fillLetters(n/320,(n/10)%32,(n/5)%2,n%5);
+    set=LetterSet(n/320,(n/10)%32,(n/5)%2,n%5);
+    for (i=0;i<32;i++)
+      if (set.patterns[i]!=letters[i] || set.rotation[i]!=rotateletter[i])
+	errors++;
+    if (LetterSet().inverse!=set.inverse)
+      errors++;
+  }
+  fillLetters(0,0,0,0);
+  cout<<"LetterSet: "<<errors<<" errors"<<endl;
+  tassert(errors==0);
+}
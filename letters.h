@@ -40,10 +40,12 @@ extern int debugletters;
 extern std::vector<uint16_t> invletters;
 extern const hvec twelve[];
 extern uint16_t ambig3[12],ambig2[60];
-extern harray<char> hletters,hbits;
+extern harray<char> hletters;
+extern harray<bool> hbits;
 extern harray<uint16_t> hglyphs;
 #define FRAMERAD 25
 #define FRAMESIZE (FRAMERAD*(FRAMERAD+1)*3+1)
+typedef hconst<FRAMERAD+1,2*FRAMERAD+1> FrameMod;
 // Possibly FRAMERAD should be 18 (almost 1 frame in each tiniest region) or 25 (1951, a little less than 2048).
 #define SLIVER_CENTROID 0.447545911917060126823164181486
 // See calculation in hvec.cpp
@@ -61,14 +63,22 @@ enum DecodeType
 int bitcount(int n);
 void degauss();
 int rotate(int bitpattern);
-void drawletter(int letter,hvec place,harray<char> &canvas=hbits);
-int readglyph(hvec place,harray<char> &canvas=hbits);
+void drawletter(int letter,hvec place,harray<bool> &canvas=hbits);
+int readglyph(hvec place,harray<bool> &canvas=hbits);
 void fillinvletters();
 void readinvletters();
 void writeinvletters();
 void checkinvletters();
 void testroundframe();
+void benchroundframe();
 void testrotate();
+void testDecodeGlyphs();
+void benchDecodeGlyphs();
+void testFrameGeometry();
+void benchshiftFrame();
+void testLitteronBank();
+void benchLitteronBank();
+void testLetterSet();
 void debugframingerror();
 void writeAmbig();
 void fillLetters(int perm,int negs,int splay,int twist);
@@ -81,14 +91,45 @@ struct Decoding
   hvec ferror;
 };
 
+class LetterSet
+/* An assignment of 12-bit patterns to the 32 letters, with the tables
+ * derived from it, so that assignments can be compared, in several threads
+ * at once, without touching the global letters. inverse is the part of
+ * invletters that depends only on the patterns: letters and patterns one
+ * bit off from 1 to 3 letters. The framing errors need --writetables.
+ */
+{
+public:
+  std::array<uint16_t,38> patterns; // 32-37 are the border letters
+  std::array<char,32> rotation; // patterns[rotation[i]]==rotate(patterns[i])
+  std::vector<uint16_t> inverse;
+  LetterSet(); // the current letters
+  LetterSet(int perm,int negs,int splay,int twist); // as fillLetters
+private:
+  void fillTables();
+};
+
 Decoding decode(int bits);
+Decoding decode(int bits,const LetterSet &set);
+void drawletter(const LetterSet &set,int letter,hvec place,harray<bool> &canvas=hbits);
+void setLetters(const LetterSet &set);
+int totalBitsDifferent(const LetterSet &set);
 
-struct InvLetterTask
+struct GlyphDecodings
+/* Arrays, each of n elements, supplied by the caller of decodeGlyphs.
+ * letters holds up to three letters, five bits each, as in invletters:
+ * for off3, the letters of decode are letters>>10, (letters>>5)&31, and
+ * letters&31; for off2, the last two; for exact and off1, only letters&31.
+ * ferror is the index in the frame hexagon of a framing error, or -1.
+ */
 {
-  harray<char> hletters;
-  int i,j,k,l;
+  DecodeType *dtype;
+  uint16_t *letters;
+  int16_t *ferror;
 };
 
+void decodeGlyphs(const uint16_t *glyphs,int n,GlyphDecodings out);
+
 struct InvLetterResult
 /* Used by threads to return the result of all framings of
  * one combination of four letters.
@@ -111,6 +152,33 @@ public:
   signed char operator[](int n);
 };
 
-InvLetterResult shiftFrame(harray<char> hletters,int i,int j,int k,int l);
+class LitteronBank
+/* The litterons of a whole symbol, stored by component: letterprob is
+ * [32][n] and softbits is [5][n], so that each step of setprob and
+ * propagate runs across all letters at once. Arguments are laid out the
+ * same way: seen is [12][n] and belief is [5][n]. The results are the same
+ * as those of litteron, which is the reference.
+ */
+{
+private:
+  int n;
+  std::vector<unsigned char> letterprob;
+  std::vector<signed char> softbits;
+  std::vector<float> work; // [32][n]
+public:
+  LitteronBank(int size=0);
+  void resize(int size);
+  int size()
+  {return n;
+   }
+  void setprob(const signed char *seen);
+  void setprob(const short *seen); // n glyphs
+  void propagate(const signed char *belief);
+  signed char get(int letter,int bit)
+  {return softbits[bit*n+letter];
+   }
+};
+
+InvLetterResult shiftFrame(const harray<char> &hletters,int i,int j,int k,int l);
 
 #endif
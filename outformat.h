@@ -43,6 +43,7 @@
 #define FMT_PNG 2
 #define FMT_JPEG 3
 #define FMT_HEXMAP 4
+#define FMT_PBM 5
 #define FMT_INFO 255
 
 #define PATTERN_8191 1
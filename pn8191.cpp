@@ -51,15 +51,25 @@ void fillpn()
     }
 }
 
-int crc(unsigned n,hvec pos)
+int crcpos(hvec pos)
+// Position of pos in the PN sequence, which is linear in pos.
 {
-  int i,ipos,bytes[4],ret=0;
-  for (i=0;i<4;i++)
-    bytes[i]=(n>>(8*i))&255;
+  int ipos;
   ipos=(pos.getx()+90*pos.gety())%8191;
   if (ipos<0)
     ipos+=8191;
-  for (i=0;i<4;i++)
-    ret^=pncode[(ipos+(8191-2048)*i)%8191][bytes[i]];
+  return ipos;
+}
+
+int crcAt(unsigned n,int ipos)
+{
+  int i,ret=0;
+  for (i=0;n;i++,n>>=8)
+    ret^=pncode[(ipos+(8191-2048)*i)%8191][n&255];
   return ret;
 }
+
+int crc(unsigned n,hvec pos)
+{
+  return crcAt(n,crcpos(pos));
+}
@@ -25,4 +25,6 @@
 extern short pncode[8191][256];
 
 void fillpn();
+int crcpos(hvec pos);
+int crcAt(unsigned n,int ipos);
 int crc(unsigned n,hvec pos);
@@ -44,8 +44,6 @@
 #include "threads.h"
 #include "genetic.h"
 
-#define tassert(x) testfail|=(!(x))
-
 using namespace std;
 namespace po=boost::program_options;
 
@@ -102,14 +100,14 @@ void pattern19()
 void pnpattern(int size)
 //size is at least 52 to see whole pattern
 {
-  hvec i;
+  hcursor<char> i(hletters,size);
   int j;
-  for (i=start(size);i.cont(size);i.inc(size))
+  for (;i.cont();i.inc())
   {
-    j=i.getx()*5+i.gety()*450;
+    j=i.where().getx()*5+i.where().gety()*450;
     j%=8191;
     while (j<0) j+=8191;
-    hletters[i]=31&pncode[j][1];
+    *i=31&pncode[j][1];
   }
 }
 
@@ -155,7 +153,7 @@ void testletter()
   b=LETTERMOD;
   debughvec=0;
   for (k=start(2);k.cont(2);k.inc(2))
-    drawletter(hletters[k],k);
+    drawletter(hletters.get(k),k);
   border(2);
   for (i=-20;i<=20;i++)
   {
@@ -192,7 +190,7 @@ void testletter()
 	//c=137*sin(q.getx())+1840*cos(exp(1)*q.gety()+1);
 	//c=hletters[q];
 	//c=((letters[c&31]>>r.letterinx())&1)*10+32;
-	c=(hbits[a]&1)*10+32;
+	c=(hbits.get(a)&1)*10+32;
 	putchar(c);
       }
     putchar('\n');
@@ -204,15 +202,16 @@ void testoutline()
   int i,j,c;
   int size=2;
   bool letterbdy;
-  hvec k;
   vector<hvec> contour;
+  vector<vector<hvec> > contours;
   pnpattern(size);
   letterbdy=false;
   b=LETTERMOD;
   debughvec=0;
-  for (k=start(size);k.cont(size);k.inc(size))
-    drawletter(hletters[k],k);
+  for (hcursor<char> c(hletters,size);c.cont();c.inc())
+    drawletter(c.get(),c.where());
   border(size);
+  contours=traceall(size); // isedge reads the copy of hbits made by traceall
   for (i=-25;i<=25;i++)
   {
     for (j=-37;j<=37;j++)
@@ -257,7 +256,7 @@ void testoutline()
   for (i=0;i<contour.size();i++)
     printf("%d,%d ",contour[i].getx(),contour[i].gety());
   putchar('\n');
-  psdraw(traceall(size),size,210,297,200,DIM_DIAPOTHEM,0,"outline.ps");
+  psdraw(contours,size,210,297,200,DIM_DIAPOTHEM,0,"outline.ps");
   // 0.07 is about my printer's inkspread
 }
 
@@ -338,7 +337,19 @@ void initialize()
   fillpn();
   fillLetters(0,0,0,0);
   readinvletters();
-  startThreads(thread::hardware_concurrency());
+}
+
+void testdivmod()
+// Checks hdivmod against the general division for each constant divisor.
+{
+  int errors[4];
+  errors[0]=checkdivmod<PageMod>(400);
+  errors[1]=checkdivmod<LetterMod>(400);
+  errors[2]=checkdivmod<TwoMod>(400);
+  errors[3]=checkdivmod<FrameMod>(400);
+  printf("hdivmod errors: PageMod %d, LetterMod %d, TwoMod %d, FrameMod %d\n",
+	 errors[0],errors[1],errors[2],errors[3]);
+  tassert(errors[0]+errors[1]+errors[2]+errors[3]==0);
 }
 
 void testlagrange()
@@ -352,21 +363,19 @@ void testlagrange()
 
 void testsetdata()
 {
-  hvec k;
   checkinvletters();
   theMatrix.findSize(108,0.2);
   theMatrix.setData("LATE@ONE@MORNING@IN@THE@MIDDLE@OF@THE@NIGHT@TWO@DEAD@BOYS@GOT@UP@TO@FIGHT@BACK@TO@BACK@THEY@FACED@EACH@OTHER",5);
   theMatrix.dump();
   theMatrix.arrange(hletters);
-  for (k=start(theMatrix.getSize());k.cont(theMatrix.getSize());k.inc(theMatrix.getSize()))
-    drawletter(hletters[k]&31,k);
+  for (hcursor<char> c(hletters,theMatrix.getSize());c.cont();c.inc())
+    drawletter(c.get()&31,c.where());
   border(theMatrix.getSize());
   psdraw(traceall(theMatrix.getSize()),theMatrix.getSize(),210,297,200,DIM_DIAPOTHEM,0,"lateonemorning.ps");
 }
 
 void makesymbol(string text,int asize,double redundancy,int format,string outfilename)
 {
-  hvec k;
   int i,size;
   bool canfit;
   double red,hired,lored;
@@ -403,8 +412,8 @@ void makesymbol(string text,int asize,double redundancy,int format,string outfil
   theMatrix.arrange(hletters);
   size=theMatrix.getSize();
   redundancy=theMatrix.getRedundancy();
-  for (k=start(size);k.cont(size);k.inc(size))
-    drawletter(hletters[k]&31,k);
+  for (hcursor<char> c(hletters,size);c.cont();c.inc())
+    drawletter(c.get()&31,c.where());
   border(size);
   switch (format)
   {
@@ -412,6 +421,8 @@ void makesymbol(string text,int asize,double redundancy,int format,string outfil
       psdraw(traceall(size),size,210,297,200,DIM_DIAPOTHEM,0,outfilename);
       break;
     case FMT_PNM:
+    case FMT_PBM:
+    case FMT_PNG:
       rasterdraw(size,0,0,600,DIM_DIAPOTHEM,format,outfilename);
       break;
     case FMT_HEXMAP:
@@ -424,13 +435,12 @@ void makesymbol(string text,int asize,double redundancy,int format,string outfil
       cout<<"Codetext: "<<encodings[i].codestring<<endl;
       break;
     default:
-      cerr<<"Format should be pgm, ps, hmap, or info"<<endl;
+      cerr<<"Format should be pgm, pbm, png, ps, hmap, or info"<<endl;
   }
 }
 
 void makepattern(int pattern,int asize,int format,string outfilename)
 {
-  hvec k;
   int i,size;
   int letterpattern; // 0: bit pattern; 1: unarranged letter pattern; 2: arranged letter pattern
   //checkinvletters();
@@ -455,8 +465,8 @@ void makepattern(int pattern,int asize,int format,string outfilename)
   if (letterpattern>1)
     theMatrix.arrange(hletters);
   if (letterpattern)
-    for (k=start(size);k.cont(size);k.inc(size))
-      drawletter(hletters[k]&31,k);
+    for (hcursor<char> c(hletters,size);c.cont();c.inc())
+      drawletter(c.get()&31,c.where());
   border(size);
   switch (format)
   {
@@ -464,13 +474,15 @@ void makepattern(int pattern,int asize,int format,string outfilename)
       psdraw(traceall(size),size,210,297,200,DIM_DIAPOTHEM,0,outfilename);
       break;
     case FMT_PNM:
+    case FMT_PBM:
+    case FMT_PNG:
       rasterdraw(size,0,0,1800,DIM_DIAPOTHEM,format,outfilename);
       break;
     case FMT_INFO:
       cout<<"Size: "<<size<<endl;
       break;
     default:
-      cerr<<"Format should be pgm, ps, or info"<<endl;
+      cerr<<"Format should be pgm, pbm, png, ps, or info"<<endl;
   }
 }
 
@@ -578,6 +590,17 @@ void testHammingPropagate()
   testHammingPropagate1(code0);
 }
 
+void benchmain()
+// Timings, which are kept out of --test because they can't fail.
+{
+  benchdivmod();
+  benchArena();
+  benchroundframe();
+  benchDecodeGlyphs();
+  benchshiftFrame();
+  benchLitteronBank();
+}
+
 void testmain()
 {
   //testoutline();
@@ -585,6 +608,8 @@ void testmain()
   listsizes();
   testfindsize();
   testCheckLetters();
+  testReadAllGlyphs();
+  testParallelFor();
   testlagrange();
   //testsetdata();
   testenc();
@@ -593,8 +618,19 @@ void testmain()
   //testraster();
   //testsixvec();
   testpageinx();
+  testdivmod();
+  testroundhvecs();
+  teststeplocregions();
+  testcursor();
+  testbitarray();
+  testcow();
+  testcrccache();
   testroundframe();
   testrotate();
+  testDecodeGlyphs();
+  testFrameGeometry();
+  testLitteronBank();
+  testLetterSet();
   debugframingerror();
   checkregbits();
   writeAmbig();
@@ -661,6 +697,12 @@ int formatnum(string optstr)
 {
   if (optstr=="pnm" || optstr=="pgm")
     return FMT_PNM;
+  if (optstr=="pbm")
+    return FMT_PBM;
+#ifdef HAVE_ZLIB
+  if (optstr=="png")
+    return FMT_PNG;
+#endif
   if (optstr=="ps")
     return FMT_PS;
   if (optstr=="hmap")
@@ -696,11 +738,11 @@ pair<string,string> checkSizeRed(const string &s)
 
 int main(int argc,char **argv)
 {
-  int testflag=0,option_index=0,makedata=0;
+  int testflag=0,benchflag=0,option_index=0,makedata=0;
   bool geneletters=false,doEcctest=false;
   int c,quality;
   double redundancy=0;
-  int size=0;
+  int size=0,nthreads=0;
   string text,infilename,outfilename;
   stringbuf filebuf;
   string redundancyStr,formatStr,patternStr;
@@ -720,11 +762,14 @@ int main(int argc,char **argv)
     ("output,o",po::value<string>(&outfilename),"Output file")
     ("format,f",po::value<string>(&formatStr)->default_value("ps"),"Output format")
     ("quality",po::value<int>(&quality)->default_value(1),"Quality of raster image (0-10)")
+    ("adaptive","Sample raster edges adaptively")
+    ("threads",po::value<int>(&nthreads)->default_value(0),"Number of threads (0: one per core)")
     ("pattern",po::value<string>(&patternStr),"Write a test pattern")
     ("writetables","Write decoding tables")
     ("geneletters","Optimize letters with genetic algorithm")
     ("ecctest","Test error correction")
     ("test","Run tests")
+    ("bench","Run benchmarks")
     ("help","Show options");
   initialize();
   cmdline_options.add(generic).add(hidden);
@@ -736,6 +781,8 @@ int main(int argc,char **argv)
     po::notify(vm);
     if (vm.count("test"))
       testflag=1;
+    if (vm.count("bench"))
+      benchflag=1;
     if (vm.count("writetables"))
       makedata=1;
     if (vm.count("geneletters"))
@@ -779,6 +826,8 @@ int main(int argc,char **argv)
     if (format<0)
       validCmd=false;
   }
+  setWorkers(nthreads);
+  startThreads(getWorkers()-1); // the main thread is the other worker
   waitForThreads(TH_RUN);
   if (validCmd)
   {
@@ -786,7 +835,11 @@ int main(int argc,char **argv)
       quality=0;
     if (quality>10)
       quality=10;
+    if (format==FMT_PBM) // PBM has no grey, so one sample per pixel
+      quality=0;
     initsubsample(quality);
+    if (vm.count("adaptive") && nsubsamples>1)
+      adaptiveError=1./nsubsamples; // as fine as the fixed subsamples
     if (makedata)
     {
       fillinvletters();
@@ -798,6 +851,8 @@ int main(int argc,char **argv)
       ecctest();
     if (testflag)
       testmain();
+    else if (benchflag)
+      benchmain();
     else if (pattern)
       makepattern(pattern,size,format,outfilename);
     else if (text.size())
@@ -24,4 +24,8 @@
 #define PROPOLIS_H
 #include <cstdint>
 #include "config.h"
+
+extern bool testfail;
+#define tassert(x) testfail|=(!(x))
+// Tests call tassert, so that --test fails if any check fails.
 #endif
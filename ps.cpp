@@ -371,7 +371,7 @@ void psdraw(vector<vector<hvec> > contours,int size,double width,double height,
           }
       // Write whether black or white is on the left (inside) of this contour.
       // This affects the inkspread compensation.
-      if (hbits[arclist[0].center/2]&1)
+      if (hbits.get(arclist[0].center/2)&1)
 	 fprintf(psfile,"bl ");
       else
          fprintf(psfile,"wl ");
@@ -29,15 +29,32 @@
 #include <cstring>
 #include <stdexcept>
 #include <vector>
+#include "config.h"
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 #include "raster.h"
+#include "threads.h"
+#include "propolis.h"
 
 using namespace std;
-fstream rfile;
 int drawmode=2;
 /* 0: each bit is drawn as a full hexagon
  * 1: each bit is drawn as 3/4 of a hexagon, and interstices are filled in with straight lines
  * 2: each bit is drawn as a circle (68% of the hexagon) and they're connected by lines
  */
+double adaptiveError=0;
+/* If nonzero, rasterdraw samples each pixel adaptively instead of at the
+ * fixed subsamples: a square is split in four until its corners lie in one
+ * convex region, or until it's no bigger than adaptiveError of a pixel.
+ */
+#define ADAPTFEATURE 0.25
+// In bits. Black and white features are at least this wide, except at the tips of fillets.
 vector<complex<double> > subsample;
 /* Corners for 85 are 42 (ur), 43 (ll), 36 (ul), and 49 (lr).
  * More generally, corners are:
@@ -106,44 +123,415 @@ locreg locregion(complex<double> z)
   return lr;
 }
 
-void ropen(string fname)
+void locregions(const double *x,const double *y,int n,locreg *lrs)
+// Batch version of locregion, for whole scanlines.
+{
+  vector<hvec> lattice(n);
+  vector<complex<double> > frac(n);
+  int i;
+  roundhvecs(x,y,n,lattice.data(),frac.data());
+  for (i=0;i<n;i++)
+  {
+    lrs[i].location=lattice[i];
+    lrs[i].region=region(frac[i]);
+    if ((drawmode==1 && lrs[i].region>6) || drawmode==0)
+      lrs[i].region=0;
+  }
+}
+
+static inline bool safelyInside(double dr,double di)
+/* Whether dr+di i, measured from a lattice point, is inside that point's
+ * hexagon by more than rounding error, so that rounding it gives that point.
+ */
+{
+  const double m=0.5-1e-9;
+  return fabs(dr)<m && fabs(dr*0.5+di*M_SQRT_3_4)<m && fabs(di*M_SQRT_3_4-dr*0.5)<m;
+}
+
+void steplocregions(const double *x,const double *y,int n,locreg *lrs)
+/* Same as locregions, for points that follow each other closely, as along
+ * a scanline or within a pixel. Each point is measured from the lattice point
+ * of the one before, and is rounded from scratch only if it's near or past
+ * the edge of that hexagon.
+ */
+{
+  int i;
+  hvec last;
+  double lr=0,li=0,dr=0,di=0;
+  for (i=0;i<n;i++)
+  {
+    dr=x[i]-lr;
+    di=y[i]-li;
+    if (i==0 || !safelyInside(dr,di))
+    {
+      last=complex<double>(x[i],y[i]);
+      lr=last.getx()-last.gety()*0.5;
+      li=last.gety()*M_SQRT_3_4;
+      dr=x[i]-lr;
+      di=y[i]-li;
+    }
+    lrs[i].location=last;
+    lrs[i].region=region(complex<double>(dr,di));
+    if ((drawmode==1 && lrs[i].region>6) || drawmode==0)
+      lrs[i].region=0;
+  }
+}
+
+#ifdef HAVE_ZLIB
+static void putbe32(vector<unsigned char> &buf,uint32_t n)
+{
+  buf.push_back(n>>24);
+  buf.push_back(n>>16);
+  buf.push_back(n>>8);
+  buf.push_back(n);
+}
+
+static int paeth(int a,int b,int c)
+{
+  int p=a+b-c,pa=abs(p-a),pb=abs(p-b),pc=abs(p-c);
+  if (pa<=pb && pa<=pc)
+    return a;
+  return (pb<=pc)?b:c;
+}
+
+static void pngfilter(const unsigned char *row,const unsigned char *prev,int n,bool bilevel,unsigned char *out)
+/* Writes the filter byte and the filtered row to out. Grey rows get whichever
+ * of the five filters has the least sum of absolute values; bilevel rows are
+ * left unfiltered, as the PNG spec advises for depths under 8.
+ */
+{
+  int f,i,a,b,c,v,sum,bestsum=INT32_MAX,best=0;
+  for (f=0;f<(bilevel?1:5);f++)
+  {
+    for (i=sum=0;i<n;i++)
+    {
+      a=i?row[i-1]:0;
+      b=prev[i];
+      c=i?prev[i-1]:0;
+      switch (f)
+      {
+	case 0: v=row[i]; break;
+	case 1: v=row[i]-a; break;
+	case 2: v=row[i]-b; break;
+	case 3: v=row[i]-(a+b)/2; break;
+	case 4: v=row[i]-paeth(a,b,c); break;
+      }
+      sum+=abs((signed char)v);
+    }
+    if (sum<bestsum)
+    {
+      bestsum=sum;
+      best=f;
+    }
+  }
+  out[0]=best;
+  for (i=0;i<n;i++)
+  {
+    a=i?row[i-1]:0;
+    b=prev[i];
+    c=i?prev[i-1]:0;
+    switch (best)
+    {
+      case 0: v=row[i]; break;
+      case 1: v=row[i]-a; break;
+      case 2: v=row[i]-b; break;
+      case 3: v=row[i]-(a+b)/2; break;
+      case 4: v=row[i]-paeth(a,b,c); break;
+    }
+    out[i+1]=v;
+  }
+}
+
+void RasterWriter::pngChunk(const char *type,const vector<unsigned char> &data)
+{
+  vector<unsigned char> head;
+  uint32_t crc;
+  putbe32(head,data.size());
+  head.insert(head.end(),type,type+4);
+  crc=crc32(crc32(0,head.data()+4,4),data.data(),data.size());
+  rfile.write((const char *)head.data(),head.size());
+  rfile.write((const char *)data.data(),data.size());
+  head.clear();
+  putbe32(head,crc);
+  rfile.write((const char *)head.data(),4);
+}
+#endif
+
+RasterWriter::RasterWriter(string fname,int width,int height,int imagetype,bool bilevel)
+/* imagetype is FMT_PNM or FMT_PNG. bilevel means every pixel is 0 or 255,
+ * so PNM is written as PBM (P4) and PNG at one bit per pixel.
+ * If the output is PNM to a regular file (or a new one) and mmap is
+ * available, the file is made its final size and mapped, and rows are
+ * copied into the mapping. Otherwise, as for stdout, a pipe, or PNG, whose
+ * size isn't known ahead, rows are written through rfile.
+ */
 {
+  string header;
+  w=width;
+  h=height;
+  type=imagetype;
+  bits=bilevel;
+  rowbytes=bits?(w+7)/8:w;
+  if (type==FMT_PNM)
+    header=string(bits?"P4\n":"P5\n")+to_string(w)+" "+to_string(h)+"\n"+(bits?"":"255\n");
+#ifdef HAVE_ZLIB
+  else if (type==FMT_PNG)
+  {
+    header="\x89PNG\r\n\x1a\n";
+    adler=adler32(0,NULL,0);
+    prevrow.assign(rowbytes,0);
+  }
+#endif
+  else
+    throw(invalid_argument("RasterWriter: unsupported image type"));
   if (fname=="")
     fname="/dev/stdout";
-  rfile.open(fname.c_str(),ios_base::out|ios_base::binary);
+  map=NULL;
+  pos=0;
+#ifdef HAVE_SYS_MMAN_H
+  struct stat st;
+  void *m;
+  fd=-1;
+  if (type==FMT_PNM && (stat(fname.c_str(),&st) || S_ISREG(st.st_mode)))
+    fd=open(fname.c_str(),O_RDWR|O_CREAT|O_TRUNC,0666);
+  if (fd>=0)
+  {
+    len=header.size()+(size_t)rowbytes*h;
+    m=MAP_FAILED;
+    if (ftruncate(fd,len)==0)
+      m=mmap(NULL,len,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    if (m!=MAP_FAILED)
+      map=(char *)m;
+    else
+    {
+      ::close(fd);
+      fd=-1;
+    }
+  }
+#endif
+  if (map)
+  {
+    memcpy(map,header.data(),header.size());
+    pos=header.size();
+  }
+  else
+  {
+    rfile.open(fname.c_str(),ios_base::out|ios_base::binary|ios_base::trunc);
+    rfile<<header;
+  }
+#ifdef HAVE_ZLIB
+  if (type==FMT_PNG)
+  {
+    vector<unsigned char> ihdr;
+    putbe32(ihdr,w);
+    putbe32(ihdr,h);
+    ihdr.push_back(bits?1:8); // bit depth
+    ihdr.push_back(0); // greyscale
+    ihdr.push_back(0); // deflate
+    ihdr.push_back(0); // adaptive filtering
+    ihdr.push_back(0); // not interlaced
+    pngChunk("IHDR",ihdr);
+    zheader=true;
+  }
+#endif
 }
 
-void rclose()
+RasterWriter::~RasterWriter()
 {
-  rfile.close();
+  close();
+}
+
+void RasterWriter::write(const char *rows,int n)
+/* rows is n rows of w grey bytes. For PBM, a pixel is black if it's darker
+ * than half; for bilevel PNG, white if it's at least half.
+ */
+{
+  int i,j;
+  char *out;
+  if (bits)
+  {
+    packed.assign((size_t)rowbytes*n,0);
+    for (i=0;i<n;i++)
+      for (j=0,out=&packed[(size_t)i*rowbytes];j<w;j++)
+	if (((unsigned char)rows[(size_t)i*w+j]<128)==(type==FMT_PNM))
+	  out[j>>3]|=0x80>>(j&7);
+    rows=packed.data();
+  }
+#ifdef HAVE_ZLIB
+  if (type==FMT_PNG)
+  {
+    writePng((const unsigned char *)rows,n);
+    return;
+  }
+#endif
+  if (map)
+  {
+    memcpy(map+pos,rows,(size_t)rowbytes*n);
+    pos+=(size_t)rowbytes*n;
+  }
+  else
+    rfile.write(rows,(size_t)rowbytes*n);
+}
+
+#ifdef HAVE_ZLIB
+void RasterWriter::writePng(const unsigned char *rows,int n)
+/* Filters and deflates n rows. They are split into groups of PNGGROUP rows,
+ * which are compressed in parallel as separate raw deflate streams, each
+ * ending in a sync flush so that they can be concatenated. The groups are
+ * then written in order as one IDAT chunk, and their Adler-32 checksums
+ * are combined into that of the whole zlib stream. Called from inside a
+ * parallelFor task, the groups are compressed one after another.
+ */
+{
+  int i,ngroups=(n+PNGGROUP-1)/PNGGROUP;
+  vector<vector<unsigned char> > zgroups(ngroups);
+  vector<uLong> adlers(ngroups);
+  vector<unsigned char> idat;
+  parallelFor(ngroups,[&](int g)
+  {
+    int r,nrows=min(PNGGROUP,n-g*PNGGROUP);
+    vector<unsigned char> filtered((size_t)(rowbytes+1)*nrows);
+    const unsigned char *row,*prev;
+    z_stream zs;
+    for (r=0;r<nrows;r++)
+    {
+      row=rows+(size_t)(g*PNGGROUP+r)*rowbytes;
+      prev=(g*PNGGROUP+r)?row-rowbytes:prevrow.data();
+      pngfilter(row,prev,rowbytes,bits,&filtered[(size_t)r*(rowbytes+1)]);
+    }
+    adlers[g]=adler32(adler32(0,NULL,0),filtered.data(),filtered.size());
+    memset(&zs,0,sizeof(zs));
+    if (deflateInit2(&zs,Z_DEFAULT_COMPRESSION,Z_DEFLATED,-15,8,Z_DEFAULT_STRATEGY)!=Z_OK)
+      throw(runtime_error("RasterWriter: deflateInit2 failed"));
+    zgroups[g].resize(deflateBound(&zs,filtered.size())+16);
+    zs.next_in=filtered.data();
+    zs.avail_in=filtered.size();
+    zs.next_out=zgroups[g].data();
+    zs.avail_out=zgroups[g].size();
+    deflate(&zs,Z_SYNC_FLUSH);
+    zgroups[g].resize(zgroups[g].size()-zs.avail_out);
+    deflateEnd(&zs);
+  });
+  if (zheader)
+  { // zlib header: deflate, 32K window, default compression
+    idat.push_back(0x78);
+    idat.push_back(0x9c);
+    zheader=false;
+  }
+  for (i=0;i<ngroups;i++)
+  {
+    idat.insert(idat.end(),zgroups[i].begin(),zgroups[i].end());
+    adler=adler32_combine(adler,adlers[i],(z_off_t)(rowbytes+1)*min(PNGGROUP,n-i*PNGGROUP));
+  }
+  if (n)
+    prevrow.assign(rows+(size_t)(n-1)*rowbytes,rows+(size_t)n*rowbytes);
+  pngChunk("IDAT",idat);
 }
+#endif
 
-void pgmheader(int width,int height)
+void RasterWriter::close()
 {
-  rfile<<"P5\n"<<width<<" "<<height<<endl<<255<<endl;
+#ifdef HAVE_ZLIB
+  if (type==FMT_PNG && rfile.is_open())
+  {
+    vector<unsigned char> idat;
+    if (zheader)
+    {
+      idat.push_back(0x78);
+      idat.push_back(0x9c);
+    }
+    idat.push_back(0x03); // empty final block with fixed codes
+    idat.push_back(0x00);
+    putbe32(idat,adler);
+    pngChunk("IDAT",idat);
+    idat.clear();
+    pngChunk("IEND",idat);
+  }
+#endif
+#ifdef HAVE_SYS_MMAN_H
+  if (map)
+  {
+    munmap(map,len);
+    ::close(fd);
+    map=NULL;
+  }
+#endif
+  if (rfile.is_open())
+    rfile.close();
 }
 
-int bit7(hvec place,harray<char> &canvas)
+template <typename A> int bit7(hvec place,A &canvas)
 {
   hvec k;
   int bits;
   for (k=start(1),bits=0;k.cont(1);k.inc(1))
-    bits=(bits<<1)|(canvas[place+k]&1);
+    bits=(bits<<1)|(canvas.get(place+k)&1);
   return bits;
 }
 
-int filletbit(complex<double> z,harray<char> &canvas)
-// Returns whether the point is white or black in the symbol as drawn with fillets and lines.
+template <typename A> int regionbit(locreg place,A &canvas)
+// Returns whether the point, already located, is white or black.
 {
   int index,shift;
-  locreg place;
-  place=locregion(z);
   index=bit7(place.location,canvas);
   shift=index&31;
   index>>=5;
   return (regbits[place.region][index]>>shift)&1;
 }
 
+int filletbit(complex<double> z,harray<bool> &canvas)
+// Returns whether the point is white or black in the symbol as drawn with fillets and lines.
+{
+  return regionbit(locregion(z),canvas);
+}
+
+void fillregmasks(hgrid<uint16_t> &masks,hgrid<char> &canvas)
+/* Sets each cell of masks to the color of each of the 13 regions around it,
+ * bit n being region n, so that a located point's color is one lookup.
+ */
+{
+  hvec h;
+  int i,index,shift,mask;
+  masks.resize(canvas.getRadius());
+  for (h=start(masks.getRadius());h.cont(masks.getRadius());h.inc(masks.getRadius()))
+  {
+    index=bit7(h,canvas);
+    shift=index&31;
+    index>>=5;
+    for (i=mask=0;i<13;i++)
+      mask|=((regbits[i][index]>>shift)&1)<<i;
+    masks[h]=mask;
+  }
+}
+
+void teststeplocregions()
+/* Checks steplocregions against locregions on scanlines at various scales,
+ * including points exactly on hexagon edges.
+ */
+{
+  int i,j,n=1000,errors=0,total=0;
+  double scale,y;
+  vector<double> xs(n),ys(n);
+  vector<locreg> a(n),b(n);
+  for (i=0;i<200;i++)
+  {
+    scale=1+i*0.37;
+    y=(i%7)*M_SQRT_3_4/2+(i%5)*M_SQRT_3_4/scale-i*0.91;
+    for (j=0;j<n;j++)
+    {
+      xs[j]=(j-n/2)/scale+((i%3)?0:0.25);
+      ys[j]=(i&1)?y:y+j*0.003;
+    }
+    locregions(xs.data(),ys.data(),n,a.data());
+    steplocregions(xs.data(),ys.data(),n,b.data());
+    for (j=0;j<n;j++,total++)
+      if (!(a[j]==b[j]))
+	errors++;
+  }
+  printf("steplocregions: %d points, %d errors\n",total,errors);
+  tassert(errors==0);
+}
+
 void checkregbits()
 {
   int i,j,shift,index,bit1,bit2;
@@ -161,20 +549,126 @@ void checkregbits()
     }
 }
 
+struct AdaptSample
+{
+  locreg place;
+  int bit;
+};
+
+static AdaptSample adaptsample(complex<double> p,double scale,complex<double> offset,hgrid<uint16_t> &masks)
+// p is in pixels from the middle of the image, up being positive.
+{
+  AdaptSample ret;
+  ret.place=locregion(p/scale+offset);
+  ret.bit=(masks.get(ret.place.location)>>ret.place.region)&1;
+  return ret;
+}
+
+static double adaptsquare(AdaptSample *c,complex<double> ll,double side,
+			  double scale,complex<double> offset,hgrid<uint16_t> &masks)
+/* c holds the samples at the lower left, lower right, upper left, and upper
+ * right corners of the square whose lower left corner is ll. Returns the
+ * black area of the square. If the corners are in the same cell and the
+ * same region, which is convex, so is the whole square, and it's one color.
+ * If they and the center are one color, and the square is too small to hold
+ * a feature of the other color, it's taken to be that color.
+ * Otherwise, if the square is small enough, its area is estimated from its
+ * corners and center; if not, it's split in four.
+ */
+{
+  AdaptSample m[5],sub[4]; // bottom, left, center, right, and top middles
+  double area=side*side,h=side/2,black;
+  if (c[0].place==c[1].place && c[0].place==c[2].place && c[0].place==c[3].place && c[0].place.region<7)
+    return area*c[0].bit;
+  m[2]=adaptsample(ll+complex<double>(h,h),scale,offset,masks);
+  if (side<=ADAPTFEATURE*scale && c[0].bit==c[1].bit && c[0].bit==c[2].bit
+      && c[0].bit==c[3].bit && c[0].bit==m[2].bit)
+    return area*c[0].bit;
+  if (area<=adaptiveError)
+    return area*(c[0].bit+c[1].bit+c[2].bit+c[3].bit+m[2].bit)/5;
+  m[0]=adaptsample(ll+complex<double>(h,0),scale,offset,masks);
+  m[1]=adaptsample(ll+complex<double>(0,h),scale,offset,masks);
+  m[3]=adaptsample(ll+complex<double>(side,h),scale,offset,masks);
+  m[4]=adaptsample(ll+complex<double>(h,side),scale,offset,masks);
+  sub[0]=c[0],sub[1]=m[0],sub[2]=m[1],sub[3]=m[2];
+  black=adaptsquare(sub,ll,h,scale,offset,masks);
+  sub[0]=m[0],sub[1]=c[1],sub[2]=m[2],sub[3]=m[3];
+  black+=adaptsquare(sub,ll+complex<double>(h,0),h,scale,offset,masks);
+  sub[0]=m[1],sub[1]=m[2],sub[2]=c[2],sub[3]=m[4];
+  black+=adaptsquare(sub,ll+complex<double>(0,h),h,scale,offset,masks);
+  sub[0]=m[2],sub[1]=m[3],sub[2]=m[4],sub[3]=c[3];
+  black+=adaptsquare(sub,ll+complex<double>(h,h),h,scale,offset,masks);
+  return black;
+}
+
+struct RowScratch
+/* Buffers for drawing a row. Each thread keeps its own from row to row,
+ * so once they are big enough, drawing a row allocates nothing.
+ */
+{
+  vector<double> x[5],y[5],subx,suby;
+  vector<locreg> loc[5],subloc;
+};
+
+static thread_local RowScratch scratch;
+
+static void adaptiverow(int i,int pwidth,int pheight,double scale,complex<double> offset,
+			hgrid<uint16_t> &masks,char *row)
+/* Draws row i with adaptive sampling. The corners of the row's pixels are
+ * located a whole edge at a time, then each pixel is split as needed.
+ */
+{
+  int j,k;
+  complex<double> z;
+  AdaptSample c[4];
+  vector<double> &x=scratch.x[0],*y=scratch.y;
+  vector<locreg> *edge=scratch.loc; // bottom and top
+  x.resize(pwidth+1);
+  for (k=0;k<2;k++)
+  {
+    y[k].resize(pwidth+1);
+    edge[k].resize(pwidth+1);
+    for (j=0;j<=pwidth;j++)
+    {
+      z=complex<double>(j-pwidth/2.-0.5,pheight/2.-i-0.5+k)/scale+offset;
+      x[j]=z.real();
+      y[k][j]=z.imag();
+    }
+    steplocregions(x.data(),y[k].data(),pwidth+1,edge[k].data());
+  }
+  for (j=0;j<pwidth;j++)
+  {
+    for (k=0;k<4;k++)
+    {
+      c[k].place=edge[k>>1][j+(k&1)];
+      c[k].bit=(masks.get(c[k].place.location)>>c[k].place.region)&1;
+    }
+    row[j]=255-lrint(255*adaptsquare(c,complex<double>(j-pwidth/2.-0.5,pheight/2.-i-0.5),1,scale,offset,masks));
+  }
+}
+
 void rasterdraw(int size,double width,double height,
 	    double scale,int dim,int imagetype,string filename)
-/* scale is in pixels. imagetype is currently ignored.
+/* scale is in pixels. imagetype is FMT_PNM for grey PGM, FMT_PBM for
+ * black and white, packed 8 pixels to a byte, or FMT_PNG, which is black
+ * and white at quality 0 and grey otherwise.
+ * Rows are drawn in bands of RASTERBAND, spread over the workers. While
+ * one band is drawn, the worker that takes the first task writes the band
+ * before it, so the bands alternate between two buffers. A PNG band is
+ * written after the next is drawn instead, since writePng spreads its
+ * deflating over the workers, which it can't do from inside a task.
  */
 {
-  int i,j,k;
-  int pixel;
+  int i,k,n,prevn;
+  bool pngout=imagetype==FMT_PNG;
   int pwidth,pheight;
-  complex<double> z,middle,offset(0,-1/M_SQRT_3);
-  hvec bend,dir,center,lastcenter,jump;
-  locreg cor0,cor1;
-  char letter;
+  complex<double> middle,offset(0,-1/M_SQRT_3);
+  hvec center;
   double symwidth,symheight;
-  ropen(filename);
+  hgrid<char> grid;
+  hgrid<uint16_t> masks;
+  vector<char> band[2];
+  char *drawing,*writing;
   switch (dim)
   {
     case DIM_LTR:
@@ -193,8 +687,6 @@ void rasterdraw(int size,double width,double height,
     }
   if (scale<=0)
     throw(range_error("rasterdraw: scale must be positive"));
-  cor0.location=cor0.region=0;
-  cor1=cor0;
   symwidth=scale*(6*(size+2));
   symheight=scale*(sqrt(48)*(size+2));
   if (width<0 || height<0)
@@ -205,30 +697,106 @@ void rasterdraw(int size,double width,double height,
     width=symwidth;
   pwidth=ceil(width);
   pheight=ceil(height);
-  pgmheader(pwidth,pheight);
-  for (i=0;i<pheight;i++)
+  /* Copy hbits into a grid big enough to hold every bit read by a sample.
+   * The corners of the image are the farthest points from the center.
+   */
+  for (i=0,k=0;i<4;i++)
+  {
+    middle=complex<double>(((i&1)-0.5)*(pwidth+1),((i>>1)-0.5)*(pheight+1));
+    center=(complex<double>)(middle/scale+offset);
+    if (center.radius()>k)
+      k=center.radius();
+  }
+  grid.resize(k+2);
+  grid.copyFrom(hbits);
+  fillregmasks(masks,grid);
+  RasterWriter out(filename,pwidth,pheight,(imagetype==FMT_PBM)?FMT_PNM:imagetype,
+		   imagetype==FMT_PBM || (imagetype==FMT_PNG && nsubsamples==1));
+  /* Each scanline is done in batches: first the center and the four corner
+   * subsamples of every pixel, then all the subsamples of each pixel whose
+   * corners don't agree. Each batch steps through the lattice, and each
+   * cell's neighborhood was looked up once, in masks.
+   */
+  auto drawrow=[&](int i,char *row)
+  {
+    int j,k,pixel;
+    int corner[5]={0,ur,ll,ul,lr}; // corner[0] is unused; sample 0 is the center
+    complex<double> z,middle;
+    locreg cor0,cor1;
+    vector<double> *cornx=scratch.x,*corny=scratch.y,&subx=scratch.subx,&suby=scratch.suby;
+    vector<locreg> *corners=scratch.loc,&subloc=scratch.subloc;
+    if (adaptiveError>0)
+    {
+      adaptiverow(i,pwidth,pheight,scale,offset,masks,row);
+      return;
+    }
+    cor0.location=cor0.region=0;
+    cor1=cor0;
+    subx.resize(nsubsamples);
+    suby.resize(nsubsamples);
+    subloc.resize(nsubsamples);
+    for (k=0;k<(ul?5:1);k++)
+    {
+      cornx[k].resize(pwidth);
+      corny[k].resize(pwidth);
+      corners[k].resize(pwidth);
+      for (j=0;j<pwidth;j++)
+      {
+	middle=complex<double>(j-pwidth/2.,pheight/2.-i);
+	z=k?(middle+subsample[corner[k]])/scale+offset:middle/scale+offset;
+	cornx[k][j]=z.real();
+	corny[k][j]=z.imag();
+      }
+      steplocregions(cornx[k].data(),corny[k].data(),pwidth,corners[k].data());
+    }
+    // if ul=0 then lr=1 which is out of range, and there's only one subsample, so no need to check the corners
     for (j=0;j<pwidth;j++)
     {
-      middle=complex<double>(j-pwidth/2.,pheight/2.-i);
-      if (ul) // if ul=0 then lr=1 which is out of range, and there's only one subsample, so no need to check the corners
+      if (ul)
       {
-	cor0=locregion((middle+subsample[ur])/scale+offset);
-	cor1=locregion((middle+subsample[ll])/scale+offset);
+	cor0=corners[1][j];
+	cor1=corners[2][j];
 	if (cor1==cor0 && cor0.region<7) // regions 7-12 are non-convex sets
 	{
-	  cor0=locregion((middle+subsample[ul])/scale+offset);
-	  cor1=locregion((middle+subsample[lr])/scale+offset);
+	  cor0=corners[3][j];
+	  cor1=corners[4][j];
 	}
       }
       if (cor1==cor0 && cor0.region<7)
-	pixel=nsubsamples*filletbit(middle/scale+offset);
+	pixel=nsubsamples*((masks.get(corners[0][j].location)>>corners[0][j].region)&1);
       else
-        for (k=pixel=0;k<nsubsamples;k++)
-        {
+      {
+	middle=complex<double>(j-pwidth/2.,pheight/2.-i);
+	for (k=0;k<nsubsamples;k++)
+	{
 	  z=(middle+subsample[k])/scale+offset;
-          pixel+=filletbit(z);
-        }
-      rfile<<(char)(255-(255*pixel+ur)/nsubsamples);
+	  subx[k]=z.real();
+	  suby[k]=z.imag();
+	}
+	steplocregions(subx.data(),suby.data(),nsubsamples,subloc.data());
+        for (k=pixel=0;k<nsubsamples;k++)
+          pixel+=(masks.get(subloc[k].location)>>subloc[k].region)&1;
+      }
+      row[j]=255-(255*pixel+ur)/nsubsamples;
     }
-  rclose();
+  };
+  band[0].resize((size_t)RASTERBAND*pwidth);
+  band[1].resize((size_t)RASTERBAND*pwidth);
+  for (i=prevn=0;i<pheight || prevn;i+=RASTERBAND)
+  {
+    n=max(0,min(RASTERBAND,pheight-i));
+    drawing=band[(i/RASTERBAND)&1].data();
+    writing=band[(i/RASTERBAND+1)&1].data();
+    parallelFor(n+1,[&](int r)
+    {
+      if (r)
+	drawrow(i+r-1,drawing+(size_t)(r-1)*pwidth);
+      else if (prevn && !pngout)
+	out.write(writing,prevn);
+    });
+    if (prevn && pngout)
+      out.write(writing,prevn);
+    prevn=n;
+  }
+  out.close();
 }
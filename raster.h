@@ -21,6 +21,8 @@
  * along with Propolis. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <string>
+#include <vector>
+#include <fstream>
 #include "hvec.h"
 #include "outformat.h"
 #include "letters.h"
@@ -35,6 +37,39 @@ struct locreg
   }
 };
 
+#define PNGGROUP 16
+// Rows deflated together when writing PNG.
+
+class RasterWriter
+/* Writes a PGM (P5), PBM (P4), or PNG image, a band of rows at a time, to
+ * a file or stdout.
+ */
+{
+  int w,h,rowbytes,type;
+  bool bits; // one bit per pixel
+  char *map; // the mapped file, or NULL if writing through rfile
+  size_t pos,len;
+  int fd;
+  std::fstream rfile;
+  std::vector<char> packed;
+  std::vector<unsigned char> prevrow; // for PNG filtering
+  unsigned long adler; // of the PNG's zlib stream
+  bool zheader; // zlib header not yet written
+  void pngChunk(const char *type,const std::vector<unsigned char> &data);
+  void writePng(const unsigned char *rows,int n);
+public:
+  RasterWriter(std::string fname,int width,int height,int imagetype,bool bilevel);
+  ~RasterWriter();
+  void write(const char *rows,int n);
+  void close();
+};
+
+extern unsigned int regbits[13][4];
+extern int nsubsamples;
+extern double adaptiveError;
+#define RASTERBAND 64
+// Rows drawn at once by rasterdraw, one at a time per worker.
+
 void initsubsample(int q);
 /* q=1: one dot per square
  * q=2: five dots per square
@@ -43,5 +78,9 @@ void initsubsample(int q);
  */
 void rasterdraw(int size,double width,double height,
 	    double scale,int dim,int imagetype,std::string filename);
-int filletbit(std::complex<double> z,harray<char> &canvas=hbits);
+int filletbit(std::complex<double> z,harray<bool> &canvas=hbits);
+void locregions(const double *x,const double *y,int n,locreg *lrs);
+void steplocregions(const double *x,const double *y,int n,locreg *lrs);
+void fillregmasks(hgrid<uint16_t> &masks,hgrid<char> &canvas);
+void teststeplocregions();
 void checkregbits();
@@ -20,46 +20,39 @@
  * You should have received a copy of the GNU General Public License
  * along with Propolis. If not, see <http://www.gnu.org/licenses/>.
  */
-#include <queue>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
 #include <iostream>
-#include <cmath>
+#include <stdexcept>
 #include "threads.h"
+#include "propolis.h"
 using namespace std;
 namespace cr=std::chrono;
 
-mutex startMutex;
-mutex taskMutex;
-mutex resultMutex;
+mutex jobMutex; // guards the job below, except jobNext
+mutex forMutex; // one parallelFor at a time uses the PropThreads
+condition_variable jobCond,doneCond;
 
-int threadCommand;
+atomic<int> threadCommand;
 vector<thread> threads;
-vector<int> threadStatus; // Bit 8 indicates whether the thread is sleeping.
-vector<double> sleepTime,sleepFraction;
-queue<InvLetterTask> taskQueue;
-queue<InvLetterResult> resultQueue;
+vector<atomic<int> > threadStatus; // Bit 8 indicates whether the thread is waiting for a job.
 
+int nWorkers=thread::hardware_concurrency();
+function<void(int)> *jobBody; // the job parallelFor has posted, or NULL
+int jobSize,jobSlots,jobRunning;
+atomic<int> jobNext;
+exception_ptr jobErr;
+thread_local bool inJob=false;
 cr::steady_clock clk;
-double opTime; // time for triop and edgeop, in milliseconds
-
-double busyFraction()
-{
-  int i,numBusy=0;
-  for (i=0;i<threadStatus.size();i++)
-    if ((threadStatus[i]&256)==0)
-      numBusy++;
-  return (double)numBusy/i;
-}
 
 void startThreads(int n)
 {
-  int i,m;
+  int i;
   threadCommand=TH_WAIT;
-  sleepTime.resize(n);
-  sleepFraction.resize(n);
-  opTime=0;
+  threadStatus=vector<atomic<int> >(n); // before any thread starts, so it never moves
   for (i=0;i<n;i++)
   {
-    sleepFraction[i]=0.5;
     threads.push_back(thread(PropThread(),i));
     this_thread::sleep_for(chrono::milliseconds(1));
   }
@@ -72,99 +65,12 @@ void joinThreads()
     threads[i].join();
 }
 
-void enqueueInvLetterTask(InvLetterTask task)
-{
-  taskMutex.lock();
-  taskQueue.push(task);
-  taskMutex.unlock();
-}
-
-InvLetterTask dequeueInvLetterTask()
-{
-  InvLetterTask ret;
-  ret.i=-1;
-  taskMutex.lock();
-  if (taskQueue.size())
-  {
-    ret=taskQueue.front();
-    taskQueue.pop();
-  }
-  taskMutex.unlock();
-  return ret;
-}
-
-int taskQueueSize()
-{
-  int ret;
-  taskMutex.lock();
-  ret=taskQueue.size();
-  taskMutex.unlock();
-  return ret;
-}
-
-void enqueueInvLetterResult(InvLetterResult result)
-{
-  resultMutex.lock();
-  resultQueue.push(result);
-  resultMutex.unlock();
-}
-
-InvLetterResult dequeueInvLetterResult()
-{
-  InvLetterResult ret;
-  ret.i=-1;
-  resultMutex.lock();
-  if (resultQueue.size())
-  {
-    ret=resultQueue.front();
-    resultQueue.pop();
-  }
-  resultMutex.unlock();
-  return ret;
-}
-
-void sleepCommon(cr::steady_clock::time_point wakeTime,int thread)
-{
-  while (clk.now()<wakeTime)
-  {
-    threadStatus[thread]|=256;
-    this_thread::sleep_for((wakeTime-clk.now())*sleepFraction[thread]);
-    sleepFraction[thread]*=1.25;
-    if (sleepFraction[thread]>0.5)
-      sleepFraction[thread]*=0.75;
-    threadStatus[thread]&=255;
-  }
-}
-
-void sleep(int thread)
-{
-  sleepTime[thread]+=1+sleepTime[thread]/1e3;
-  if (sleepTime[thread]>opTime*sleepTime.size()/2+500)
-    sleepTime[thread]=opTime*sleepTime.size()/2+500;
-  cr::steady_clock::time_point wakeTime=clk.now()+cr::milliseconds(lrint(sleepTime[thread]));
-  sleepCommon(wakeTime,thread);
-}
-
-void unsleep(int thread)
-{
-  sleepTime[thread]-=1+sleepTime[thread]/1e3;
-  if (sleepTime[thread]<0 || std::isnan(sleepTime[thread]))
-    sleepTime[thread]=0;
-}
-
-double maxSleepTime()
-{
-  int i;
-  double max=0;
-  for (i=0;i<sleepTime.size();i++)
-    if (sleepTime[i]>max)
-      max=sleepTime[i];
-  return max;
-}
-
 void setThreadCommand(int newStatus)
 {
+  jobMutex.lock();
   threadCommand=newStatus;
+  jobMutex.unlock();
+  jobCond.notify_all();
   //cout<<statusNames[newStatus]<<endl;
 }
 
@@ -173,7 +79,7 @@ int getThreadStatus()
  * aaaaaaaaaa is the status all threads should be in,
  * bbbbbbbbbb is 0 if all threads are in the same state, and
  * cccccccccc is the state the threads are in.
- * If all threads are in the commanded state, but some may be asleep and others awake,
+ * If all threads are in the commanded state, but some may be waiting for a job and others not,
  * getThreadStatus()&0x3ffbfeff is a multiple of 1048577.
  */
 {
@@ -191,7 +97,7 @@ void waitForThreads(int newStatus)
 // Waits until all threads are in the commanded status.
 {
   int i,n;
-  threadCommand=newStatus;
+  setThreadCommand(newStatus);
   do
   {
     for (i=n=0;i<threadStatus.size();i++)
@@ -201,31 +107,56 @@ void waitForThreads(int newStatus)
   } while (n);
 }
 
-void PropThread::operator()(int thread)
+void runJob()
+// Takes indices of the posted job until there are none left.
 {
-  int e=0,t=0,d=0;
-  InvLetterTask task;
-  startMutex.lock();
-  if (threadStatus.size()!=thread)
+  int j;
+  inJob=true;
+  while ((j=jobNext++)<jobSize)
+    try
+    {
+      (*jobBody)(j);
+    }
+    catch (...)
+    {
+      jobMutex.lock();
+      if (!jobErr)
+	jobErr=current_exception();
+      jobMutex.unlock();
+      jobNext=jobSize;
+    }
+  inJob=false;
+}
+
+void waitForJob(int thread)
+/* Waits until parallelFor has a slot open, then helps with the job.
+ * The timeout lets the thread notice a change of command.
+ */
+{
+  unique_lock<mutex> lock(jobMutex);
+  threadStatus[thread]|=TH_ASLEEP;
+  jobCond.wait_for(lock,cr::milliseconds(100),[]{return jobSlots>0 || threadCommand!=TH_RUN;});
+  threadStatus[thread]&=255;
+  if (jobSlots>0 && threadCommand==TH_RUN)
   {
-    //cout<<"Starting thread "<<threadStatus.size()<<", was passed "<<thread<<endl;
-    thread=threadStatus.size();
+    jobSlots--;
+    jobRunning++;
+    lock.unlock();
+    runJob();
+    lock.lock();
+    if (--jobRunning==0)
+      doneCond.notify_all();
   }
-  threadStatus.push_back(0);
-  startMutex.unlock();
+}
+
+void PropThread::operator()(int thread)
+{
   while (threadCommand!=TH_STOP)
   {
     if (threadCommand==TH_RUN)
     {
       threadStatus[thread]=TH_RUN;
-      task=dequeueInvLetterTask();
-      if (task.i<0)
-	sleep(thread);
-      else
-      {
-	enqueueInvLetterResult(shiftFrame(task.hletters,task.i,task.j,task.k,task.l));
-	unsleep(thread);
-      }
+      waitForJob(thread);
     }
     if (threadCommand==TH_PAUSE)
     {
@@ -236,3 +167,91 @@ void PropThread::operator()(int thread)
   }
   threadStatus[thread]=TH_STOP;
 }
+
+void setWorkers(int n)
+// Sets the number of threads used by parallelFor. 0 means one per core.
+{
+  if (n<1)
+    n=thread::hardware_concurrency();
+  nWorkers=(n<1)?1:n;
+}
+
+int getWorkers()
+{
+  return nWorkers;
+}
+
+void parallelFor(int n,function<void(int)> body,int grain)
+/* Calls body(i) for i from 0 to n-1, spread over up to nWorkers threads,
+ * which take indices in order as they finish the previous ones. The calling
+ * thread is one of them; the others are PropThreads, which must be running.
+ * grain is the fewest indices worth handing to another thread, so that
+ * small jobs, and calls from inside body, run inline. If body throws,
+ * the first exception is rethrown after all threads finish.
+ */
+{
+  int i,slots=min(nWorkers,(int)threads.size()+1);
+  if (grain<1)
+    grain=1;
+  slots=min(slots,n/grain)-1;
+  if (slots<1 || inJob)
+  {
+    for (i=0;i<n;i++)
+      body(i);
+    return;
+  }
+  lock_guard<mutex> forLock(forMutex);
+  unique_lock<mutex> lock(jobMutex);
+  jobBody=&body;
+  jobSize=n;
+  jobNext=0;
+  jobErr=nullptr;
+  jobSlots=slots;
+  lock.unlock();
+  jobCond.notify_all();
+  runJob();
+  lock.lock();
+  jobSlots=0;
+  doneCond.wait(lock,[]{return jobRunning==0;});
+  jobBody=NULL;
+  if (jobErr)
+    rethrow_exception(jobErr);
+}
+
+void testParallelFor()
+/* Checks that every index is done once, that a call from inside body
+ * runs inline, and that an exception from body reaches the caller.
+ */
+{
+  vector<int> done(1000);
+  atomic<int> nested(0);
+  int i,errors=0;
+  bool caught=false;
+  parallelFor(1000,[&](int j)
+  {
+    done[j]++;
+    if (j%100==0)
+      parallelFor(10,[&](int){nested++;});
+  });
+  for (i=0;i<1000;i++)
+    if (done[i]!=1)
+      errors++;
+  if (nested!=100)
+    errors++;
+  try
+  {
+    parallelFor(1000,[&](int j)
+    {
+      if (j==500)
+	throw(runtime_error("testParallelFor"));
+    });
+  }
+  catch (runtime_error &e)
+  {
+    caught=true;
+  }
+  if (!caught)
+    errors++;
+  cout<<"parallelFor on "<<threads.size()<<" PropThreads: "<<errors<<" errors"<<endl;
+  tassert(errors==0);
+}
@@ -26,6 +26,7 @@
 #include <chrono>
 #include <vector>
 #include <array>
+#include <functional>
 #include "mthreads.h"
 #include "letters.h"
 
@@ -40,21 +41,13 @@ extern std::chrono::steady_clock clk;
 
 void startThreads(int n);
 void joinThreads();
-void enqueueInvLetterTask(InvLetterTask task);
-InvLetterTask dequeueInvLetterTask();
-int taskQueueSize();
-void enqueueInvLetterResult(InvLetterResult result);
-InvLetterResult dequeueInvLetterResult();
-void sleepRead();
-void sleep(int thread);
-void sleepDead(int thread);
-void unsleep(int thread);
-double maxSleepTime();
-void randomizeSleep();
 void setThreadCommand(int newStatus);
 int getThreadStatus();
 void waitForThreads(int newStatus);
-void waitForQueueEmpty();
+void setWorkers(int n);
+int getWorkers();
+void parallelFor(int n,std::function<void(int)> body,int grain=1);
+void testParallelFor();
 
 class PropThread
 {